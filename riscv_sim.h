@@ -0,0 +1,91 @@
+// C interface for embedding the simulator in other programs.
+//
+// Build simulator.cpp with RISCV_SIM_NO_MAIN defined (e.g. as a shared
+// library: g++ -shared -fPIC -DRISCV_SIM_NO_MAIN simulator.cpp) and link
+// against it. Every function takes the handle returned by riscv_sim_create.
+// Simulators are created with the pipeline trace and progress messages off,
+// so the library writes nothing to stdout (errors still go to stderr).
+#ifndef RISCV_SIM_H
+#define RISCV_SIM_H
+
+#if defined(_WIN32) && defined(RISCV_SIM_NO_MAIN)
+#define RISCV_SIM_API __declspec(dllexport)
+#else
+#define RISCV_SIM_API
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+    typedef struct riscv_sim riscv_sim;
+
+    // Statistics of the detailed pipeline and the functional engine
+    typedef struct riscv_sim_stats
+    {
+        long long cycles;
+        long long instructions;            // Retired by the pipeline
+        long long functional_instructions; // Executed by the functional engine
+        long long stalls;
+        double cpi;                        // cycles / instructions (0 if none)
+    } riscv_sim_stats;
+
+    // Creates a simulator with memory_words words of memory (<= 0 for the
+    // default size). Returns NULL on failure.
+    RISCV_SIM_API riscv_sim *riscv_sim_create(int memory_words);
+    RISCV_SIM_API void riscv_sim_destroy(riscv_sim *sim);
+
+    // Program loading, returning 0 on success and -1 on error (including
+    // running out of memory)
+    RISCV_SIM_API int riscv_sim_load_program(riscv_sim *sim, const char *filename);
+    RISCV_SIM_API int riscv_sim_load_core_program(riscv_sim *sim, int core, const char *filename, int entry_pc);
+
+    // Configuration
+    RISCV_SIM_API void riscv_sim_set_latency(riscv_sim *sim, const char *opcode, int latency);
+    RISCV_SIM_API void riscv_sim_set_forwarding(riscv_sim *sim, int enable);
+    RISCV_SIM_API void riscv_sim_set_trace(riscv_sim *sim, int enable);
+
+    // Simulates up to cycles cycles of the detailed pipeline and returns
+    // how many were simulated (fewer once every core has finished). Once every
+    // core has finished, the statistics count the final idle cycle just like
+    // a run of the command-line simulator; it counts against cycles too.
+    RISCV_SIM_API long long riscv_sim_run_cycles(riscv_sim *sim, long long cycles);
+
+    // Simulates until core is about to fetch the instruction at pc, for at
+    // most max_cycles cycles (< 0 for no limit). Returns 1 if pc was
+    // reached, 0 if the limit was hit or every core finished first.
+    RISCV_SIM_API int riscv_sim_run_until_pc(riscv_sim *sim, int core, int pc, long long max_cycles);
+
+    // Runs every core on the functional engine (no pipeline timing) for up
+    // to max_instructions_per_core instructions (< 0 until each leaves its
+    // program) and returns how many it executed. They are counted in
+    // functional_instructions, not in the pipeline statistics.
+    RISCV_SIM_API long long riscv_sim_run_functional(riscv_sim *sim, long long max_instructions_per_core);
+
+    // Returns 1 once every core has finished and its pipeline drained
+    RISCV_SIM_API int riscv_sim_finished(riscv_sim *sim);
+
+    // Back to the state right after loading (programs and configuration kept)
+    RISCV_SIM_API void riscv_sim_reset(riscv_sim *sim);
+
+    // State queries; out-of-range arguments read as 0
+    RISCV_SIM_API int riscv_sim_register(riscv_sim *sim, int core, int reg);
+    RISCV_SIM_API int riscv_sim_pc(riscv_sim *sim, int core);
+    RISCV_SIM_API int riscv_sim_memory_word(riscv_sim *sim, long long address);
+    RISCV_SIM_API void riscv_sim_get_stats(riscv_sim *sim, riscv_sim_stats *stats);
+
+    // Checkpoints, returning 0 on success and -1 on error. Corrupt or
+    // truncated checkpoint files are rejected and leave the simulator as it was.
+    RISCV_SIM_API int riscv_sim_save_checkpoint(riscv_sim *sim, const char *filename, int incremental);
+    RISCV_SIM_API int riscv_sim_load_checkpoint(riscv_sim *sim, const char *filename);
+
+    // Writes the loaded programs as a standalone C++ program to filename
+    // (ahead-of-time translation). Returns 0 on success and -1 on error.
+    RISCV_SIM_API int riscv_sim_translate(riscv_sim *sim, const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
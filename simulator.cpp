@@ -5,6 +5,43 @@
 #include <cctype>
 #include <iomanip> // For formatting output
 #include <map>     // For instruction latencies
+#include <cstring>
+#include <cmath>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <climits>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <set>
+#include <cassert>
+#include "riscv_sim.h"
+#ifdef __linux__
+#include <sys/mman.h> // For huge page backed memory and the JIT code cache
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>   // fork() for copy-on-write what-if runs
+#include <sys/wait.h>
+#include <poll.h>
+#include <cerrno>
+#define FORK_SUPPORTED 1
+#else
+#define FORK_SUPPORTED 0
+#endif
+
+// The JIT backend emits x86-64 code and needs mmap for its code cache
+#ifdef __SSE2__
+#include <emmintrin.h> // Host SIMD for lockstep execution across cores
+#endif
+#if defined(__x86_64__) && defined(__linux__)
+#define JIT_SUPPORTED 1
+#else
+#define JIT_SUPPORTED 0
+#endif
 
 using namespace std;
 
@@ -12,6 +49,32 @@ using namespace std;
 const int NUM_CORES = 4;      // Simulated CPU cores
 const int MEMORY_SIZE = 4096; // Memory size (in words)
 
+const char CHECKPOINT_MAGIC[8] = {'R', 'V', 'S', 'I', 'M', 'C', 'K', '4'}; // Checkpoint file header
+const int MAX_CHECKPOINT_CHAIN = 256; // Incremental checkpoints a restore may follow
+// Part of every sweep cache key; bump it whenever a change to the simulator
+// alters the statistics of a run, so cached sweep results go stale
+const int SWEEP_MODEL_VERSION = 3;
+
+// Checkpoint memory page records
+enum CheckpointPage : uint8_t
+{
+    PAGE_ZERO,     // All words zero, no data stored
+    PAGE_DATA,     // Words follow
+    PAGE_PARENT    // Unchanged since the parent checkpoint
+};
+
+// Predecoded operation kinds used by the functional engine. Instructions
+// whose operands are invalid decode to OP_NOP, since they only advance the PC.
+enum OpKind
+{
+    OP_NOP,
+    OP_ADD,
+    OP_SUB,
+    OP_JAL,
+    OP_BNE,
+    OP_SWAP
+};
+
 // Instruction structure
 struct Instruction
 {
@@ -19,490 +82,4270 @@ struct Instruction
     int rd, rs1, rs2, imm; // Register indices and immediate
     int core_id;            // The core this instruction belongs to
     int pc;                 // Program counter value for this instruction
+    OpKind kind;            // Predecoded operation (set by decode_line)
 
     Instruction(string op = "", int r = -1, int s1 = -1, int s2 = -1, int i = 0, int id = -1, int pc_val = 0)
-        : opcode(op), rd(r), rs1(s1), rs2(s2), imm(i), core_id(id), pc(pc_val) {}
+        : opcode(op), rd(r), rs1(s1), rs2(s2), imm(i), core_id(id), pc(pc_val), kind(OP_NOP) {}
 };
 
-// Represents a RISC-V core (CPU thread)
-struct Core
+// One non-control instruction of a translated basic block: the handler is
+// bound at translation time and the register operands are stored inline.
+struct TranslatedOp
 {
-    int registers[32]; // General-purpose registers
-    int pc;            // Program Counter
-    int core_id;       // Unique ID for each core
-    bool stalled;      // Flag to indicate if the core is stalled
-
-    Core(int id) : pc(0), core_id(id), stalled(false)
-    {
-        fill(begin(registers), end(registers), 0);
-        registers[3] = core_id; // Store core ID in x3 (arbitrary convention)
-    }
+    void (*handler)(int *regs, const TranslatedOp &op);
+    int rd, rs1, rs2;
 };
 
-// Pipeline Stage structure
-struct PipelineStage
+static void op_add(int *regs, const TranslatedOp &op) { regs[op.rd] = regs[op.rs1] + regs[op.rs2]; }
+static void op_sub(int *regs, const TranslatedOp &op) { regs[op.rd] = regs[op.rs1] - regs[op.rs2]; }
+static void op_swap(int *regs, const TranslatedOp &op) { swap(regs[op.rs1], regs[op.rs2]); }
+
+// A basic block translated for the functional engine. The body holds the
+// straight-line instructions; the terminator (BNE, JAL or a fall-through)
+// is resolved at the end of the block.
+struct TranslatedBlock
 {
-    Instruction instruction;
-    bool valid; // Indicates if the stage contains a valid instruction
-    int latency_counter; // Counter for instruction latency
-    PipelineStage() : valid(false), latency_counter(0) {}
+    int start_pc;
+    int length;      // Instructions in the block, including the terminator
+    OpKind terminator;
+    int term_rd, term_rs1, term_imm;
+    vector<TranslatedOp> body;
+    bool valid;
+    long long executions; // Times run by the block interpreter (JIT hotness)
 };
 
-class RiscVSimulator
+// Executable code cache holding x86-64 translations of hot basic blocks.
+// Native blocks are entered as
+//     int block(int *regs, long long budget, long long *budget_left)
+// keep the remaining instruction budget in rsi, jump straight into each
+// other once chained, and return the next guest PC to the dispatcher when
+// they leave translated code or run out of budget.
+class JitCodeCache
 {
 private:
-    vector<Core> cores;          // All CPU cores
-    vector<int> memory;          // Simulated RAM
-    vector<string> instructions; // Loaded instructions
-
-    // Pipeline stages for each core
-    vector<PipelineStage> fetch_stage;
-    vector<PipelineStage> decode_stage;
-    vector<PipelineStage> execute_stage;
-    vector<PipelineStage> memory_stage;
-    vector<PipelineStage> writeback_stage;
-
-    // Instruction Latencies (user configurable)
-    map<string, int> instruction_latencies;
+    static const size_t CODE_CACHE_BYTES = 4 * 1024 * 1024;
 
-    bool forwarding_enabled; // Flag to enable or disable data forwarding
+    // Encoded sizes of the pieces compile() emits
+    static const size_t PROLOGUE_BYTES = 20;  // cmp/jl/sub on the budget
+    static const size_t ALU_BYTES = 18;       // ADD/SUB: three [rdi + disp32] moves
+    static const size_t SWAP_BYTES = 24;      // Four [rdi + disp32] moves
+    static const size_t EXIT_BYTES = 9;       // emit_exit() stub
+    static const size_t BNE_BYTES = 18 + 2 * EXIT_BYTES;
+    static const size_t JAL_BYTES = 10 + EXIT_BYTES;
 
-    // Statistics
-    int total_cycles;
-    int total_stalls;
+    uint8_t *code;
+    size_t used;
+    bool failed;                         // Code cache could not be mapped
+    vector<uint8_t *> entry;             // Native entry of each translated block
+    map<int, uint8_t *> entry_at_pc;     // Native entry by guest start PC
+    multimap<int, uint8_t *> unchained;  // Exit stubs waiting for their target PC
 
-    // Check if a given register index is valid
-    bool is_valid_register(int reg_index)
+    void emit8(uint8_t byte) { code[used++] = byte; }
+    void emit32(int32_t value)
     {
-        return reg_index >= 0 && reg_index < 32;
+        memcpy(code + used, &value, 4);
+        used += 4;
     }
-
-    // Extracts register index from a string like "x5"
-    int extract_reg_index(const string &reg_str)
+    // Instruction with a [rdi + 4*reg] operand: opcode, modrm(reg field)
+    void emit_reg_operand(uint8_t opcode, uint8_t modrm, int reg)
     {
-        if (reg_str.empty() || reg_str[0] != 'x')
-            return -1;
+        emit8(opcode);
+        emit8(modrm);
+        emit32(reg * 4);
+    }
 
-        try
-        {
-            int reg_num = stoi(reg_str.substr(1));
-            return (reg_num >= 0 && reg_num < 32) ? reg_num : -1;
-        }
-        catch (const invalid_argument &)
+    // mov eax, pc ; mov [rdx], rsi ; ret -- the first 5 bytes are later
+    // replaced by a jmp once the target block is translated
+    uint8_t *emit_exit(int target_pc, bool chainable)
+    {
+        uint8_t *stub = code + used;
+        emit8(0xB8);
+        emit32(target_pc);
+        emit8(0x48);
+        emit8(0x89);
+        emit8(0x32);
+        emit8(0xC3);
+        if (chainable)
         {
-            return -1; // Invalid register
+            auto target = entry_at_pc.find(target_pc);
+            if (target != entry_at_pc.end())
+                chain(stub, target->second);
+            else
+                unchained.insert(make_pair(target_pc, stub));
         }
+        return stub;
     }
 
-    // Parses immediate values (handles decimal, hex, and binary)
-    int parse_immediate(const string &str)
+    // Exact number of bytes compile() emits for block
+    static size_t block_bytes(const TranslatedBlock &block)
     {
-        if (str.empty())
-            return 0;
-
-        try
-        {
-            if (str.size() > 2 && str[0] == '0')
-            {
-                if (str[1] == 'x' || str[1] == 'X')
-                    return stoi(str, nullptr, 16); // Hexadecimal
-                if (str[1] == 'b' || str[1] == 'B')
-                    return stoi(str.substr(2), nullptr, 2); // Binary
-            }
-            return stoi(str); // Decimal
-        }
-        catch (const invalid_argument &)
+        size_t bytes = PROLOGUE_BYTES;
+        for (const TranslatedOp &op : block.body)
         {
-            return 0; // Invalid immediate, default to 0
+            if (op.handler == op_add || op.handler == op_sub)
+                bytes += ALU_BYTES;
+            else if (op.handler == op_swap)
+                bytes += SWAP_BYTES;
         }
+        if (block.terminator == OP_BNE)
+            bytes += BNE_BYTES;
+        else if (block.terminator == OP_JAL)
+            bytes += JAL_BYTES;
+        else
+            bytes += EXIT_BYTES;
+        return bytes + EXIT_BYTES; // Bail stub
     }
 
-    // Fetches the instruction for a given core
-    Instruction fetch(Core &core)
+    static void chain(uint8_t *stub, uint8_t *target)
     {
-        if (core.pc / 4 < instructions.size())
-        {
-            string instruction_str = instructions[core.pc / 4];
-            istringstream iss(instruction_str);
-            string opcode, arg1, arg2, arg3;
-            iss >> opcode >> arg1 >> arg2 >> arg3;
-
-            int rd = extract_reg_index(arg1);
-            int rs1 = extract_reg_index(arg2);
-            int rs2 = extract_reg_index(arg3);
-            int imm = parse_immediate(arg3); // Use arg3 for immediate value
-
-            return Instruction(opcode, rd, rs1, rs2, imm, core.core_id, core.pc);
-        }
-        return Instruction(); // Return a default instruction if no more instructions
+        int32_t rel = target - (stub + 5);
+        stub[0] = 0xE9;
+        memcpy(stub + 1, &rel, 4);
     }
 
-    // Decodes the instruction and performs register fetch
-    Instruction decode(Instruction &instruction)
+public:
+    JitCodeCache() : code(nullptr), used(0), failed(false) {}
+
+    // Copies start with an empty cache; translations are redone on demand
+    JitCodeCache(const JitCodeCache &) : code(nullptr), used(0), failed(false) {}
+    JitCodeCache &operator=(const JitCodeCache &)
     {
-        // This is where you would typically check for data dependencies
-        // and potential stalls.  For now, we'll just pass the instruction along.
-        return instruction;
+        flush();
+        return *this;
     }
 
-    // Executes the instruction
-    void execute(Instruction &instruction, Core &core)
+    ~JitCodeCache()
     {
-        if (instruction.opcode == "JAL")
-        { // Jump and Link
-            if (is_valid_register(instruction.rd))
-            {
-                core.registers[instruction.rd] = instruction.pc + 4; // Store return address
-                core.pc += instruction.imm;
-            }
-        }
-        else if (instruction.opcode == "BNE")
-        { // Branch if Not Equal
-            if (is_valid_register(instruction.rd) && is_valid_register(instruction.rs1))
-            {
-                if (core.registers[instruction.rd] != core.registers[instruction.rs1])
-                {
-                    core.pc += instruction.imm;
-                }
-                else
-                {
-                    core.pc += 4;
-                }
-                return; // Important: Skip the default PC increment
-            }
-        }
-        else if (instruction.opcode == "ADD")
-        { // Addition
-            if (is_valid_register(instruction.rd) && is_valid_register(instruction.rs1) && is_valid_register(instruction.rs2))
-            {
-                core.registers[instruction.rd] = core.registers[instruction.rs1] + core.registers[instruction.rs2];
-            }
-        }
-        else if (instruction.opcode == "SUB")
-        { // Subtraction
-            if (is_valid_register(instruction.rd) && is_valid_register(instruction.rs1) && is_valid_register(instruction.rs2))
-            {
-                core.registers[instruction.rd] = core.registers[instruction.rs1] - core.registers[instruction.rs2];
-            }
-        }
-        else if (instruction.opcode == "SWAP")
-        { // Swap two registers
-            if (is_valid_register(instruction.rs1) && is_valid_register(instruction.rs2))
-            {
-                swap(core.registers[instruction.rs1], core.registers[instruction.rs2]);
-            }
-        }
-        core.pc += 4; // Default PC increment
+#if JIT_SUPPORTED
+        if (code)
+            munmap(code, CODE_CACHE_BYTES);
+#endif
     }
 
-    // Memory access stage (currently empty)
-    void memory_access(Instruction &instruction)
+    bool available() const { return JIT_SUPPORTED && !failed; }
+    size_t compiled_blocks() const { return entry_at_pc.size(); }
+
+    uint8_t *lookup(int block_index) const
     {
-        // Implement memory read/write operations here
+        return block_index < (int)entry.size() ? entry[block_index] : nullptr;
     }
 
-    // Writeback stage
-    void writeback(Instruction &instruction, Core &core)
+    // Drops every translation (after a store into the code or when full)
+    void flush()
     {
-        // This is where you write the result back to the register file.
-        // For now, it's empty as the execution directly updates registers.
+        used = 0;
+        entry.clear();
+        entry_at_pc.clear();
+        unchained.clear();
     }
 
-    // Checks for data dependencies and inserts stalls if necessary.
-    bool check_data_hazards(Core &core)
+    // Emits native code for a translated block; returns nullptr when the
+    // JIT is unavailable on this host
+    uint8_t *compile(int block_index, const TranslatedBlock &block)
     {
-        // Example: Check if the current instruction in the decode stage depends
-        // on a register being written to by an instruction in the execute or
-        // memory stage.
-        if (!decode_stage[core.core_id].valid)
-            return false;
+#if JIT_SUPPORTED
+        if (!code && !failed)
+        {
+            void *p = mmap(nullptr, CODE_CACHE_BYTES, PROT_READ | PROT_WRITE | PROT_EXEC,
+                           MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (p == MAP_FAILED)
+                failed = true;
+            else
+                code = (uint8_t *)p;
+        }
+        if (failed)
+            return nullptr;
+        size_t bytes = block_bytes(block);
+        if (bytes > CODE_CACHE_BYTES)
+            return nullptr;
+        if (used + bytes > CODE_CACHE_BYTES)
+            flush();
 
-        Instruction &decode_inst = decode_stage[core.core_id].instruction;
+        uint8_t *start = code + used;
+        int term_pc = block.start_pc + 4 * (block.length - 1);
 
-        // Check against execute stage
-        if (execute_stage[core.core_id].valid && execute_stage[core.core_id].instruction.rd != -1)
+        // cmp rsi, length ; jl bail ; sub rsi, length
+        emit8(0x48);
+        emit8(0x81);
+        emit8(0xFE);
+        emit32(block.length);
+        emit8(0x0F);
+        emit8(0x8C);
+        size_t bail_rel = used;
+        emit32(0);
+        emit8(0x48);
+        emit8(0x81);
+        emit8(0xEE);
+        emit32(block.length);
+
+        for (const TranslatedOp &op : block.body)
         {
-            Instruction &execute_inst = execute_stage[core.core_id].instruction;
-            if ((decode_inst.rs1 == execute_inst.rd || decode_inst.rs2 == execute_inst.rd) && forwarding_enabled == false)
+            if (op.handler == op_add || op.handler == op_sub)
             {
-                total_stalls++;
-                return true; // Stall needed
+                emit_reg_operand(0x8B, 0x87, op.rs1);                             // mov eax, [rs1]
+                emit_reg_operand(op.handler == op_add ? 0x03 : 0x2B, 0x87, op.rs2); // add/sub eax, [rs2]
+                emit_reg_operand(0x89, 0x87, op.rd);                              // mov [rd], eax
             }
-        }
-
-        // Check against memory stage
-        if (memory_stage[core.core_id].valid && memory_stage[core.core_id].instruction.rd != -1)
-        {
-            Instruction &memory_inst = memory_stage[core.core_id].instruction;
-            if ((decode_inst.rs1 == memory_inst.rd || decode_inst.rs2 == memory_inst.rd) && forwarding_enabled == false)
+            else if (op.handler == op_swap)
             {
-                total_stalls++;
-                return true; // Stall needed
+                emit_reg_operand(0x8B, 0x87, op.rs1); // mov eax, [rs1]
+                emit_reg_operand(0x8B, 0x8F, op.rs2); // mov ecx, [rs2]
+                emit_reg_operand(0x89, 0x8F, op.rs1); // mov [rs1], ecx
+                emit_reg_operand(0x89, 0x87, op.rs2); // mov [rs2], eax
             }
         }
 
-        // Check against writeback stage
-        if (writeback_stage[core.core_id].valid && writeback_stage[core.core_id].instruction.rd != -1)
+        if (block.terminator == OP_BNE)
         {
-            Instruction &writeback_inst = writeback_stage[core.core_id].instruction;
-            if ((decode_inst.rs1 == writeback_inst.rd || decode_inst.rs2 == writeback_inst.rd) && forwarding_enabled == false)
-            {
-                total_stalls++;
-                return true; // Stall needed
-            }
+            emit_reg_operand(0x8B, 0x87, block.term_rd);  // mov eax, [rd]
+            emit_reg_operand(0x3B, 0x87, block.term_rs1); // cmp eax, [rs1]
+            emit8(0x0F);                                  // jne taken
+            emit8(0x85);
+            emit32(9);
+            emit_exit(term_pc + 4, true);
+            emit_exit(term_pc + block.term_imm, true);
+        }
+        else if (block.terminator == OP_JAL)
+        {
+            emit8(0xC7); // mov dword [rd], return address
+            emit8(0x87);
+            emit32(block.term_rd * 4);
+            emit32(term_pc + 4);
+            emit_exit(term_pc + block.term_imm + 4, true);
+        }
+        else
+        {
+            emit_exit(term_pc + 4, true);
         }
 
-        return false; // No stall needed
-    }
+        // Not enough budget left for this block: hand it back unexecuted
+        int32_t rel = (code + used) - (code + bail_rel + 4);
+        memcpy(code + bail_rel, &rel, 4);
+        emit_exit(block.start_pc, false);
 
-    // Performs data forwarding if enabled
-    void perform_data_forwarding(Core &core)
-    {
-        if (!decode_stage[core.core_id].valid)
-            return;
+        assert(code + used == start + bytes);
 
-        Instruction &decode_inst = decode_stage[core.core_id].instruction;
+        if ((int)entry.size() <= block_index)
+            entry.resize(block_index + 1, nullptr);
+        entry[block_index] = start;
+        entry_at_pc[block.start_pc] = start;
 
-        // Forward from execute stage
-        if (execute_stage[core.core_id].valid && execute_stage[core.core_id].instruction.rd != -1)
+        // Chain earlier blocks that exit to this one
+        auto waiting = unchained.equal_range(block.start_pc);
+        for (auto it = waiting.first; it != waiting.second; ++it)
         {
-            Instruction &execute_inst = execute_stage[core.core_id].instruction;
-            if (decode_inst.rs1 == execute_inst.rd)
-            {
-                decode_inst.rs1 = execute_inst.rd; // Forward the result
-                cout << "Data forwarding: Core " << core.core_id << ", forwarding from execute to decode for register x" << decode_inst.rs1 << endl;
-            }
-            if (decode_inst.rs2 == execute_inst.rd)
-            {
-                decode_inst.rs2 = execute_inst.rd; // Forward the result
-                cout << "Data forwarding: Core " << core.core_id << ", forwarding from execute to decode for register x" << decode_inst.rs2 << endl;
-            }
+            chain(it->second, start);
         }
+        unchained.erase(waiting.first, waiting.second);
+        return start;
+#else
+        (void)block_index;
+        (void)block;
+        return nullptr;
+#endif
+    }
 
-        // Forward from memory stage
-        if (memory_stage[core.core_id].valid && memory_stage[core.core_id].instruction.rd != -1)
+    // Runs native code from entry_point until it returns to the dispatcher.
+    // Returns the next guest PC and updates budget.
+    static int run(uint8_t *entry_point, int *regs, long long &budget)
+    {
+        typedef int (*NativeBlock)(int *, long long, long long *);
+        long long left = budget;
+        int pc = ((NativeBlock)entry_point)(regs, budget, &left);
+        budget = left;
+        return pc;
+    }
+};
+
+// A decoded program: the assembly lines and their predecoded form. One
+// copy is shared read-only by every core and by all simulator instances in
+// the process that load the same source; stores into the code go to a
+// private copy of the code space (see store_instruction).
+struct DecodedProgram
+{
+    vector<string> source;            // Assembly lines
+    vector<Instruction> instructions; // Predecoded form of each line (core_id -1)
+};
+
+// A program as seen by the cores running it: the shared decoded program
+// plus the translation caches the functional engine builds from it. Cores
+// running the same program share one code space.
+struct CodeSpace
+{
+    shared_ptr<const DecodedProgram> program;
+    vector<shared_ptr<const DecodedProgram>> versions; // Programs in-flight instructions came from; program last
+    shared_ptr<DecodedProgram> modified;       // Private copy after a store into the code
+    vector<int> block_of;                      // Basic block index of each instruction
+    vector<TranslatedBlock> translated_blocks; // Basic-block translation cache
+    vector<int> block_at;                      // Translated block starting at each instruction (-1 = none)
+    vector<vector<int>> page_blocks;           // Translated blocks overlapping each code page
+    vector<bool> code_page_dirty;              // Pages written since the program was loaded
+    JitCodeCache jit;                          // Native code for hot blocks
+
+    int size() const { return program->instructions.size(); }
+};
+
+// Fixed set of host threads running independent tasks. Each worker owns a
+// deque: it takes its newest task first and, once its deque is empty,
+// steals the oldest task of another worker, so uneven task lengths still
+// keep every thread busy.
+class WorkStealingPool
+{
+    struct Worker
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+    vector<unique_ptr<Worker>> workers;
+
+    bool take(int self, function<void()> &task)
+    {
         {
-            Instruction &memory_inst = memory_stage[core.core_id].instruction;
-            if (decode_inst.rs1 == memory_inst.rd)
+            Worker &own = *workers[self];
+            lock_guard<mutex> guard(own.lock);
+            if (!own.tasks.empty())
             {
-                decode_inst.rs1 = memory_inst.rd; // Forward the result
-                cout << "Data forwarding: Core " << core.core_id << ", forwarding from memory to decode for register x" << decode_inst.rs1 << endl;
-            }
-            if (decode_inst.rs2 == memory_inst.rd)
-            {
-                decode_inst.rs2 = memory_inst.rd; // Forward the result
-                cout << "Data forwarding: Core " << core.core_id << ", forwarding from memory to decode for register x" << decode_inst.rs2 << endl;
+                task = move(own.tasks.back());
+                own.tasks.pop_back();
+                return true;
             }
         }
-
-        // Forward from writeback stage
-        if (writeback_stage[core.core_id].valid && writeback_stage[core.core_id].instruction.rd != -1)
+        for (size_t i = 1; i < workers.size(); i++)
         {
-            Instruction &writeback_inst = writeback_stage[core.core_id].instruction;
-            if (decode_inst.rs1 == writeback_inst.rd)
-            {
-                decode_inst.rs1 = writeback_inst.rd; // Forward the result
-                cout << "Data forwarding: Core " << core.core_id << ", forwarding from writeback to decode for register x" << decode_inst.rs1 << endl;
-            }
-            if (decode_inst.rs2 == writeback_inst.rd)
+            Worker &victim = *workers[(self + i) % workers.size()];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty())
             {
-                decode_inst.rs2 = writeback_inst.rd; // Forward the result
-                cout << "Data forwarding: Core " << core.core_id << ", forwarding from writeback to decode for register x" << decode_inst.rs2 << endl;
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
             }
         }
+        return false;
     }
 
-    // Sorts a partition of memory assigned to a core
-    void bubble_sort_memory(Core &core)
+public:
+    // threads = 0 sizes the pool to the host
+    explicit WorkStealingPool(int threads = 0)
     {
-        int start_idx = core.core_id * (MEMORY_SIZE / NUM_CORES);
-        int end_idx = start_idx + (MEMORY_SIZE / NUM_CORES);
+        if (threads <= 0)
+            threads = max(1u, thread::hardware_concurrency());
+        for (int i = 0; i < threads; i++)
+            workers.emplace_back(new Worker());
+    }
 
-        for (int i = start_idx; i < end_idx - 1; i++)
+    int size() const { return workers.size(); }
+
+    // Runs every task and returns once all of them have finished. Tasks
+    // must not submit further tasks.
+    void run(vector<function<void()>> tasks)
+    {
+        for (size_t i = 0; i < tasks.size(); i++)
+            workers[i % workers.size()]->tasks.push_back(move(tasks[i]));
+
+        auto work = [this](int self)
         {
-            for (int j = start_idx; j < end_idx - (i - start_idx) - 1; j++)
-            {
-                if (memory[j] > memory[j + 1])
-                {
-                    swap(memory[j], memory[j + 1]);
-                }
-            }
-        }
+            function<void()> task;
+            while (take(self, task))
+                task();
+        };
+        vector<thread> threads;
+        for (int i = 1; i < size(); i++)
+            threads.emplace_back(work, i);
+        work(0);
+        for (auto &t : threads)
+            t.join();
     }
+};
 
-public:
-    RiscVSimulator() : memory(MEMORY_SIZE, 0),
-                        fetch_stage(NUM_CORES),
-                        decode_stage(NUM_CORES),
-                        execute_stage(NUM_CORES),
-                        memory_stage(NUM_CORES),
-                        writeback_stage(NUM_CORES),
-                        forwarding_enabled(true), // Default: forwarding enabled
-                        total_cycles(0),
-                        total_stalls(0)
+// A callback scheduled on the event queue. Events due at the same time run
+// in priority order, then in the order they were scheduled.
+struct Event
+{
+    long long time;
+    int priority;
+    long long sequence;
+    function<void()> action;
+
+    bool operator<(const Event &other) const
     {
-        for (int i = 0; i < NUM_CORES; i++)
-        {
-            cores.emplace_back(i);
-        }
+        if (time != other.time)
+            return time < other.time;
+        if (priority != other.priority)
+            return priority < other.priority;
+        return sequence < other.sequence;
+    }
+};
 
-        // Default instruction latencies
-        instruction_latencies["ADD"] = 1;
-        instruction_latencies["SUB"] = 1;
-        instruction_latencies["JAL"] = 1;
-        instruction_latencies["BNE"] = 1;
-        instruction_latencies["SWAP"] = 1;
+// Calendar queue (Brown, 1988). Events are hashed by time into a ring of
+// buckets one "day" wide; popping walks the ring one day at a time. The
+// ring is resized, and the day width re-estimated from the spacing of
+// pending events, whenever the event count doubles or halves, which keeps
+// insert and pop O(1) amortized.
+class EventQueue
+{
+    vector<vector<Event>> buckets; // Each sorted latest first
+    long long width;               // Time span of one bucket
+    size_t count;
+    size_t current;                // Bucket being drained
+    long long bucket_top;          // End of the current bucket's day
+    long long now;                 // Time of the last popped event
+    long long next_sequence;
+
+    size_t bucket_of(long long time) const
+    {
+        return (size_t)(time / width) % buckets.size();
     }
 
-    // Allows user to set instruction latencies
-    void set_instruction_latency(const string &opcode, int latency)
+    void insert(Event event)
     {
-        instruction_latencies[opcode] = latency;
+        vector<Event> &bucket = buckets[bucket_of(event.time)];
+        auto it = upper_bound(bucket.begin(), bucket.end(), event,
+                              [](const Event &a, const Event &b) { return b < a; });
+        bucket.insert(it, move(event));
+        count++;
     }
 
-    // Enables or disables data forwarding
-    void enable_forwarding(bool enable)
+    // Moves to the day holding time
+    void seek(long long time)
     {
-        forwarding_enabled = enable;
+        current = bucket_of(time);
+        bucket_top = (time / width + 1) * width;
     }
 
-    // Loads assembly instructions from a file
-    void load_instructions(const string &filename)
+    void resize(size_t bucket_count)
     {
-        ifstream file(filename);
-        if (!file.is_open())
+        vector<Event> pending;
+        pending.reserve(count);
+        for (auto &bucket : buckets)
         {
-            cerr << "Error: Cannot open " << filename << endl;
-            return;
+            for (auto &event : bucket)
+                pending.push_back(move(event));
         }
+        sort(pending.begin(), pending.end());
 
-        string line;
-        while (getline(file, line))
+        // Day width: a few times the mean spacing of the earliest events
+        width = 1;
+        size_t samples = min<size_t>(pending.size(), 25);
+        if (samples > 1)
         {
-            if (!line.empty())
-            {
-                instructions.push_back(line);
-            }
+            long long span = pending[samples - 1].time - pending[0].time;
+            width = max(1LL, 3 * span / (long long)(samples - 1));
         }
-        cout << "Loaded " << instructions.size() << " instructions from " << filename << "." << endl;
+
+        buckets.assign(bucket_count, vector<Event>());
+        count = 0;
+        for (auto &event : pending)
+            insert(move(event));
+        seek(pending.empty() ? now : pending[0].time);
     }
 
-    // Executes loaded instructions across all cores (Pipelined)
-    void execute()
+    // Moves to the day holding the earliest pending event (count > 0)
+    void find_earliest()
     {
-        bool cores_active = true;
-        while (cores_active)
+        for (size_t days = 0;; days++)
         {
-            cores_active = false;
-            total_cycles++;
-
-            // Iterate through each core and process the pipeline stages
-            for (auto &core : cores)
+            vector<Event> &bucket = buckets[current];
+            if (!bucket.empty() && bucket.back().time < bucket_top)
+                return;
+            if (days == buckets.size())
             {
-                if (core.pc / 4 < instructions.size() ||
-                    fetch_stage[core.core_id].valid ||
-                    decode_stage[core.core_id].valid ||
-                    execute_stage[core.core_id].valid ||
-                    memory_stage[core.core_id].valid ||
-                    writeback_stage[core.core_id].valid)
+                // A whole year without a due event: jump to the earliest one
+                long long earliest = LLONG_MAX;
+                for (auto &b : buckets)
                 {
-                    cores_active = true; // Core is still active
+                    if (!b.empty())
+                        earliest = min(earliest, b.back().time);
+                }
+                seek(earliest);
+                days = 0;
+                continue;
+            }
+            current = (current + 1) % buckets.size();
+            bucket_top += width;
+        }
+    }
 
-                    // Writeback Stage
-                    if (writeback_stage[core.core_id].valid)
-                    {
-                        cout << "Core " << core.core_id << " - Writeback: " << writeback_stage[core.core_id].instruction.opcode << endl;
-                        writeback(writeback_stage[core.core_id].instruction, core);
-                        writeback_stage[core.core_id].valid = false;
-                    }
+public:
+    EventQueue() : buckets(2), width(1), count(0), current(0), bucket_top(1), now(0), next_sequence(0) {}
 
-                    // Memory Stage
-                    if (memory_stage[core.core_id].valid)
-                    {
-                        cout << "Core " << core.core_id << " - Memory: " << memory_stage[core.core_id].instruction.opcode << endl;
-                        memory_access(memory_stage[core.core_id].instruction);
-                        PipelineStage &stage = memory_stage[core.core_id];
-                        writeback_stage[core.core_id] = stage;
-                        memory_stage[core.core_id].valid = false;
-                    }
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    long long time() const { return now; }
 
-                    // Execute Stage
-                    if (execute_stage[core.core_id].valid)
-                    {
-                        // Check if the instruction has finished its latency
-                        if (execute_stage[core.core_id].latency_counter > 1)
-                        {
-                            execute_stage[core.core_id].latency_counter--;
-                        }
-                        else
-                        {
-                            cout << "Core " << core.core_id << " - Execute: " << execute_stage[core.core_id].instruction.opcode << endl;
-                            execute(execute_stage[core.core_id].instruction, core);
-                            PipelineStage &stage = execute_stage[core.core_id];
-                            memory_stage[core.core_id] = stage;
-                            execute_stage[core.core_id].valid = false;
-                        }
-                    }
+    // Time of the earliest pending event (LLONG_MAX if none)
+    long long next_time()
+    {
+        if (count == 0)
+            return LLONG_MAX;
+        find_earliest();
+        return buckets[current].back().time;
+    }
+
+    // Schedules action to run at time (not earlier than the current time)
+    void schedule(long long time, int priority, function<void()> action)
+    {
+        insert(Event{time, priority, next_sequence++, move(action)});
+        if (time < bucket_top - width)
+            seek(time);
+        if (count > 2 * buckets.size())
+            resize(2 * buckets.size());
+    }
+
+    // Removes the earliest event, advances the current time to it and
+    // runs it. Returns false if nothing is pending before limit.
+    bool run_next(long long limit = LLONG_MAX)
+    {
+        if (next_time() >= limit)
+            return false;
+
+        vector<Event> &bucket = buckets[current];
+        Event event = move(bucket.back());
+        bucket.pop_back();
+        count--;
+        now = event.time;
+        if (buckets.size() > 2 && count < buckets.size() / 2)
+            resize(buckets.size() / 2);
+        event.action();
+        return true;
+    }
+
+    void clear()
+    {
+        buckets.assign(2, vector<Event>());
+        width = 1;
+        count = 0;
+        seek(now);
+    }
+};
+
+// One simulation of a batch: a program and the configuration to run it
+// with on the detailed pipeline
+struct SimulationJob
+{
+    string program_file;          // Loaded for every core, like load_instructions()
+    map<string, int> latencies;   // Instruction latencies overriding the defaults
+    bool forwarding;              // Data forwarding on or off
+    int memory_words;             // Simulated memory size
+    long long max_instructions;   // Instructions fetched per core (-1 = run to completion)
+
+    SimulationJob(const string &file = "")
+        : program_file(file), forwarding(true), memory_words(MEMORY_SIZE), max_instructions(-1) {}
+};
+
+// Statistics record returned for each job of a batch
+struct SimulationStats
+{
+    bool loaded;              // False if the program could not be read
+    long long cycles;
+    int stalls;
+    long long instructions;   // Instructions retired by the pipeline
+    double cpi;
+    int registers[NUM_CORES][32];
+
+    SimulationStats() : loaded(false), cycles(0), stalls(0), instructions(0), cpi(0.0)
+    {
+        memset(registers, 0, sizeof(registers));
+    }
+};
+
+// Parameter ranges of a design-space sweep. Every combination of one value
+// per range is a design point.
+struct SweepSpace
+{
+    string program_file;
+    map<string, vector<int>> latencies; // Latencies to try per opcode
+    vector<bool> forwarding;            // Forwarding settings to try
+    long long max_instructions;         // Per core for every point (-1 = run to completion)
+
+    SweepSpace(const string &file = "")
+        : program_file(file), forwarding(1, true), max_instructions(-1) {}
+};
+
+// A simulated (or remembered) design point
+struct SweepResult
+{
+    SimulationJob job;
+    SimulationStats stats;
+    bool cached; // Taken from the result cache instead of simulated
+};
+
+// A representative simulation interval selected by SimPoint-style clustering
+struct SimPoint
+{
+    long long interval; // Interval index (in units of the profiling interval size)
+    double weight;      // Fraction of the program's intervals it represents
+
+    SimPoint(long long i = 0, double w = 0.0) : interval(i), weight(w) {}
+};
+
+// Simulation modes: the detailed 5-stage pipeline, the functional ISS, the
+// functional ISS running cores that share a PC in SIMD lockstep, or the
+// detailed pipeline driven by the event queue, serially or with the cores
+// partitioned across host threads (optionally checked against the serial
+// loop), or the functional engines checked against each other
+enum SimulationMode
+{
+    DETAILED_MODE,
+    FUNCTIONAL_MODE,
+    LOCKSTEP_MODE,
+    EVENT_MODE,
+    PARALLEL_MODE,
+    VERIFY_MODE,
+    VERIFY_FUNCTIONAL_MODE
+};
+
+// Lane-wise register operations for lockstep execution. Each array holds
+// one register for every core; only lanes whose mask is all ones change.
+static inline void lanes_add(int *d, const int *a, const int *b, const int *mask, bool subtract)
+{
+    int lane = 0;
+#ifdef __SSE2__
+    for (; lane + 4 <= NUM_CORES; lane += 4)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + lane));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + lane));
+        __m128i vd = _mm_loadu_si128((const __m128i *)(d + lane));
+        __m128i m = _mm_loadu_si128((const __m128i *)(mask + lane));
+        __m128i r = subtract ? _mm_sub_epi32(va, vb) : _mm_add_epi32(va, vb);
+        _mm_storeu_si128((__m128i *)(d + lane), _mm_or_si128(_mm_and_si128(m, r), _mm_andnot_si128(m, vd)));
+    }
+#endif
+    for (; lane < NUM_CORES; lane++)
+    {
+        if (mask[lane])
+            d[lane] = subtract ? a[lane] - b[lane] : a[lane] + b[lane];
+    }
+}
+
+static inline void lanes_swap(int *a, int *b, const int *mask)
+{
+    int lane = 0;
+#ifdef __SSE2__
+    for (; lane + 4 <= NUM_CORES; lane += 4)
+    {
+        __m128i va = _mm_loadu_si128((const __m128i *)(a + lane));
+        __m128i vb = _mm_loadu_si128((const __m128i *)(b + lane));
+        __m128i m = _mm_loadu_si128((const __m128i *)(mask + lane));
+        _mm_storeu_si128((__m128i *)(a + lane), _mm_or_si128(_mm_and_si128(m, vb), _mm_andnot_si128(m, va)));
+        _mm_storeu_si128((__m128i *)(b + lane), _mm_or_si128(_mm_and_si128(m, va), _mm_andnot_si128(m, vb)));
+    }
+#endif
+    for (; lane < NUM_CORES; lane++)
+    {
+        if (mask[lane])
+            swap(a[lane], b[lane]);
+    }
+}
+
+// Represents a RISC-V core (CPU thread)
+struct Core
+{
+    int registers[32]; // General-purpose registers
+    int pc;            // Program Counter
+    int core_id;       // Unique ID for each core
+    bool stalled;      // Flag to indicate if the core is stalled
+
+    Core(int id) : pc(0), core_id(id), stalled(false)
+    {
+        fill(begin(registers), end(registers), 0);
+        registers[3] = core_id; // Store core ID in x3 (arbitrary convention)
+    }
+};
+
+// Host allocation backing the simulated RAM. Can optionally be placed on
+// huge pages so that large memories don't thrash the host TLB. Writes go
+// through store() so that pages modified since the last checkpoint are
+// known.
+class MemoryBacking
+{
+private:
+    int *data;
+    size_t words;
+    size_t mapped_bytes; // Non-zero when the words were mmap'ed
+    bool huge_requested; // Whether huge pages were asked for
+    string page_kind;    // Kind of host pages actually obtained
+    vector<uint8_t> dirty;   // Pages written since clear_dirty()
+    vector<uint8_t> written; // Pages that may be non-zero (written since zero())
+
+    static const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+
+#ifdef __linux__
+    // Returns the AnonHugePages (in kB) of the mapping containing addr
+    static size_t anon_huge_kb(const void *addr)
+    {
+        ifstream smaps("/proc/self/smaps");
+        unsigned long target = (unsigned long)addr;
+        bool in_mapping = false;
+        string line;
+        while (getline(smaps, line))
+        {
+            unsigned long lo, hi;
+            if (sscanf(line.c_str(), "%lx-%lx ", &lo, &hi) == 2)
+            {
+                in_mapping = target >= lo && target < hi;
+            }
+            else if (in_mapping && line.compare(0, 14, "AnonHugePages:") == 0)
+            {
+                return stoul(line.substr(14));
+            }
+        }
+        return 0;
+    }
+
+    // Tries hugetlb pages first, then transparent huge pages
+    bool allocate_huge(size_t bytes)
+    {
+        size_t length = (bytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+#ifdef MAP_HUGETLB
+        void *p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED)
+        {
+            data = (int *)p;
+            mapped_bytes = length;
+            page_kind = "hugetlb pages";
+            return true;
+        }
+#endif
+        // Over-allocate so the region can be aligned to a huge page boundary
+        size_t raw_length = length + HUGE_PAGE_BYTES;
+        void *raw = mmap(nullptr, raw_length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (raw == MAP_FAILED)
+            return false;
+
+        unsigned long start = ((unsigned long)raw + HUGE_PAGE_BYTES - 1) & ~(HUGE_PAGE_BYTES - 1);
+        size_t head = start - (unsigned long)raw;
+        if (head > 0)
+            munmap(raw, head);
+        if (raw_length - head > length)
+            munmap((char *)start + length, raw_length - head - length);
+
+        data = (int *)start;
+        mapped_bytes = length;
+#ifdef MADV_HUGEPAGE
+        madvise(data, length, MADV_HUGEPAGE);
+#endif
+        // Touch every page so the kernel backs the region now
+        for (size_t off = 0; off < length; off += 4096)
+            ((volatile char *)data)[off] = 0;
+
+        page_kind = anon_huge_kb(data) > 0 ? "transparent huge pages" : "regular pages (huge pages unavailable)";
+        return true;
+    }
+#endif
+
+    void allocate(size_t n, bool huge)
+    {
+        data = nullptr;
+        words = n;
+        dirty.assign((n + PAGE_WORDS - 1) / PAGE_WORDS, 0);
+        written.assign(dirty.size(), 0);
+        mapped_bytes = 0;
+        huge_requested = huge;
+        page_kind = "regular pages";
+#ifdef __linux__
+        if (huge && n > 0 && allocate_huge(n * sizeof(int)))
+            return;
+#endif
+        if (huge)
+            page_kind = "regular pages (huge pages unavailable)";
+        data = new int[n]();
+    }
+
+    void release()
+    {
+#ifdef __linux__
+        if (mapped_bytes > 0)
+        {
+            munmap(data, mapped_bytes);
+            data = nullptr;
+            return;
+        }
+#endif
+        delete[] data;
+        data = nullptr;
+    }
+
+public:
+    static constexpr size_t PAGE_WORDS = 1024; // Granularity of dirty tracking (4 KB)
+
+    MemoryBacking(size_t n = 0, bool huge = false)
+    {
+        allocate(n, huge);
+    }
+
+    MemoryBacking(const MemoryBacking &other)
+    {
+        allocate(other.words, other.huge_requested);
+        memcpy(data, other.data, words * sizeof(int));
+        dirty = other.dirty;
+        written = other.written;
+    }
+
+    MemoryBacking &operator=(const MemoryBacking &other)
+    {
+        if (this != &other)
+        {
+            release();
+            allocate(other.words, other.huge_requested);
+            memcpy(data, other.data, words * sizeof(int));
+            dirty = other.dirty;
+            written = other.written;
+        }
+        return *this;
+    }
+
+    ~MemoryBacking()
+    {
+        release();
+    }
+
+    void swap(MemoryBacking &other)
+    {
+        std::swap(data, other.data);
+        std::swap(words, other.words);
+        std::swap(mapped_bytes, other.mapped_bytes);
+        std::swap(huge_requested, other.huge_requested);
+        std::swap(page_kind, other.page_kind);
+        dirty.swap(other.dirty);
+        written.swap(other.written);
+    }
+
+    // Copies the words and dirty pages of another backing of the same size
+    void copy_from(const MemoryBacking &other)
+    {
+        memcpy(data, other.data, words * sizeof(int));
+        dirty = other.dirty;
+        written = other.written;
+    }
+
+    const int &operator[](size_t i) const { return data[i]; }
+    size_t size() const { return words; }
+
+    void store(size_t i, int value)
+    {
+        data[i] = value;
+        dirty[i / PAGE_WORDS] = 1;
+        written[i / PAGE_WORDS] = 1;
+    }
+
+    // Clears the memory, touching only the pages written since the last
+    // zero(), so resetting a mostly untouched memory is cheap
+    void zero()
+    {
+        for (size_t page = 0; page < written.size(); page++)
+        {
+            if (!written[page])
+                continue;
+            memset(data + page * PAGE_WORDS, 0, page_size(page) * sizeof(int));
+            written[page] = 0;
+            dirty[page] = 1;
+        }
+    }
+
+    // Pages of PAGE_WORDS words (the last one may be shorter)
+    size_t pages() const { return dirty.size(); }
+    size_t page_size(size_t page) const { return min(PAGE_WORDS, words - page * PAGE_WORDS); }
+    const int *page_words(size_t page) const { return data + page * PAGE_WORDS; }
+    int *writable_page(size_t page)
+    {
+        dirty[page] = 1;
+        written[page] = 1;
+        return data + page * PAGE_WORDS;
+    }
+
+    bool page_dirty(size_t page) const { return dirty[page] != 0; }
+    void clear_dirty() { fill(dirty.begin(), dirty.end(), 0); }
+
+    bool huge_pages() const
+    {
+        return page_kind == "hugetlb pages" || page_kind == "transparent huge pages";
+    }
+    const string &description() const { return page_kind; }
+};
+
+// Pipeline latches of one stage for every core, in structure-of-arrays
+// form. A latched instruction is identified by its fetch PC in the
+// predecoded program it was fetched from rather than by a copy of the
+// Instruction. Holding that program keeps an in-flight instruction intact
+// when a store into the code replaces the core's program.
+struct PipelineLatch
+{
+    bool valid[NUM_CORES]; // Indicates if the stage holds a valid instruction
+    int pc[NUM_CORES];     // Fetch PC of the latched instruction
+    int space[NUM_CORES];  // Code space and program version fetched from
+    int version[NUM_CORES];
+
+    PipelineLatch()
+    {
+        fill(begin(valid), end(valid), false);
+        fill(begin(pc), end(pc), 0);
+        fill(begin(space), end(space), 0);
+        fill(begin(version), end(version), 0);
+    }
+};
+
+class RiscVSimulator
+{
+private:
+    vector<Core> cores;          // All CPU cores
+    MemoryBacking memory;        // Simulated RAM
+    // Loaded programs. Space 0 holds the program shared by all cores;
+    // cores given their own program run from another space.
+    vector<CodeSpace> code_spaces;
+    vector<int> core_space; // Code space each core runs from
+    vector<int> entry_pc;   // Where each core starts after a reset
+
+    // Basic-block translation cache for the functional engine
+    bool block_cache_enabled;
+    long long block_translations;
+
+    // Self-modifying code detection. The instruction space is split into
+    // code pages; a store into a page only does work when the page has
+    // translated blocks, which are then invalidated.
+    static const int CODE_PAGE_INSTRUCTIONS = 64;
+    long long code_invalidations; // Blocks invalidated by stores into the code
+
+    // x86-64 dynamic binary translation of hot blocks
+    bool jit_enabled;
+
+    // Pipeline stages for each core
+    PipelineLatch fetch_stage;
+    PipelineLatch decode_stage;
+    PipelineLatch execute_stage;
+    PipelineLatch memory_stage;
+    PipelineLatch writeback_stage;
+    int latency_counter[NUM_CORES]; // Cycles left in each core's execute stage
+    EventQueue events;              // Timed components of the event-driven engine
+
+    // Instruction Latencies (user configurable)
+    map<string, int> instruction_latencies;
+
+    bool forwarding_enabled; // Flag to enable or disable data forwarding
+    bool precise_pipeline;   // Resolve branches against their own PC (see enable_precise_pipeline)
+    SimulationMode mode;     // Engine used by run()
+    bool trace_enabled;      // Print per-stage pipeline activity
+    bool verbose;            // Print progress messages such as program loads
+    bool cycle_skipping_enabled; // Jump over cycles in which only execute latencies count down
+    vector<string> checkpoint_chain; // Checkpoint the memory's dirty pages are relative to, then its ancestors
+    vector<long long> fetch_budget; // Instructions each core may still fetch (-1 = unlimited)
+
+    // Statistics
+    long long total_cycles;
+    bool idle_cycle_counted; // total_cycles includes the cycle that found every core idle
+    int core_stalls[NUM_CORES];          // Data hazard stalls of each core
+    long long core_retired[NUM_CORES];   // Instructions retired by each core's pipeline
+    long long functional_instructions; // Instructions retired by the functional engine
+
+    // Per-core trace captured while cores run on host threads
+    struct CoreTraceBuffer
+    {
+        ostringstream text;                         // Output of the current cycle
+        vector<pair<long long, string>> cycles;     // Completed cycles
+    };
+    CoreTraceBuffer *trace_buffers[NUM_CORES]; // Set during parallel runs, else null
+
+    // Stream receiving a core's pipeline trace
+    ostream &trace_out(int core_id)
+    {
+        if (trace_buffers[core_id])
+            return trace_buffers[core_id]->text;
+        return cout;
+    }
+
+    int stall_count() const
+    {
+        int stalls = 0;
+        for (int stalls_of_core : core_stalls)
+            stalls += stalls_of_core;
+        return stalls;
+    }
+
+    long long retired_count() const
+    {
+        long long retired = 0;
+        for (long long retired_by_core : core_retired)
+            retired += retired_by_core;
+        return retired;
+    }
+
+    // Check if a given register index is valid
+    static bool is_valid_register(int reg_index)
+    {
+        return reg_index >= 0 && reg_index < 32;
+    }
+
+    // Extracts register index from a string like "x5"
+    static int extract_reg_index(const string &reg_str)
+    {
+        if (reg_str.empty() || reg_str[0] != 'x')
+            return -1;
+
+        try
+        {
+            int reg_num = stoi(reg_str.substr(1));
+            return (reg_num >= 0 && reg_num < 32) ? reg_num : -1;
+        }
+        catch (const invalid_argument &)
+        {
+            return -1; // Invalid register
+        }
+    }
+
+    // Parses immediate values (handles decimal, hex, and binary)
+    static int parse_immediate(const string &str)
+    {
+        if (str.empty())
+            return 0;
+
+        try
+        {
+            if (str.size() > 2 && str[0] == '0')
+            {
+                if (str[1] == 'x' || str[1] == 'X')
+                    return stoi(str, nullptr, 16); // Hexadecimal
+                if (str[1] == 'b' || str[1] == 'B')
+                    return stoi(str.substr(2), nullptr, 2); // Binary
+            }
+            return stoi(str); // Decimal
+        }
+        catch (const invalid_argument &)
+        {
+            return 0; // Invalid immediate, default to 0
+        }
+    }
+
+    // Parses one line of assembly into an Instruction
+    static Instruction decode_line(const string &instruction_str, int core_id, int pc)
+    {
+        istringstream iss(instruction_str);
+        string opcode, arg1, arg2, arg3;
+        iss >> opcode >> arg1 >> arg2 >> arg3;
+
+        int rd = extract_reg_index(arg1);
+        int rs1 = extract_reg_index(arg2);
+        int rs2 = extract_reg_index(arg3);
+        int imm = parse_immediate(arg3); // Use arg3 for immediate value
+
+        Instruction instruction(opcode, rd, rs1, rs2, imm, core_id, pc);
+
+        // Fold the operand checks done by execute() into the operation kind
+        if (opcode == "JAL" && is_valid_register(rd))
+            instruction.kind = OP_JAL;
+        else if (opcode == "BNE" && is_valid_register(rd) && is_valid_register(rs1))
+            instruction.kind = OP_BNE;
+        else if (opcode == "ADD" && is_valid_register(rd) && is_valid_register(rs1) && is_valid_register(rs2))
+            instruction.kind = OP_ADD;
+        else if (opcode == "SUB" && is_valid_register(rd) && is_valid_register(rs1) && is_valid_register(rs2))
+            instruction.kind = OP_SUB;
+        else if (opcode == "SWAP" && is_valid_register(rs1) && is_valid_register(rs2))
+            instruction.kind = OP_SWAP;
+
+        return instruction;
+    }
+
+    // FNV-1a over the lines of a program
+    static uint64_t program_hash(const vector<string> &source)
+    {
+        uint64_t hash = 14695981039346656037ULL;
+        for (auto &line : source)
+        {
+            for (unsigned char c : line)
+            {
+                hash ^= c;
+                hash *= 1099511628211ULL;
+            }
+            hash ^= '\n';
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // Returns the process-wide decoded copy of a program, decoding it only
+    // if no live simulator already holds one for the same source. The cache
+    // is keyed by hash; the programs themselves hold the only copy of their
+    // source, which settles collisions.
+    static shared_ptr<const DecodedProgram> shared_program(const vector<string> &source)
+    {
+        static mutex cache_mutex;
+        static map<uint64_t, vector<weak_ptr<const DecodedProgram>>> cache;
+
+        lock_guard<mutex> lock(cache_mutex);
+        vector<weak_ptr<const DecodedProgram>> &candidates = cache[program_hash(source)];
+        shared_ptr<const DecodedProgram> decoded;
+        for (auto &candidate : candidates)
+        {
+            shared_ptr<const DecodedProgram> program = candidate.lock();
+            if (program && program->source == source)
+            {
+                decoded = program;
+                break;
+            }
+        }
+        if (!decoded)
+        {
+            shared_ptr<DecodedProgram> fresh = make_shared<DecodedProgram>();
+            fresh->source = source;
+            for (size_t i = 0; i < source.size(); i++)
+            {
+                fresh->instructions.push_back(decode_line(source[i], -1, i * 4));
+            }
+            decoded = fresh;
+            candidates.push_back(decoded);
+        }
+
+        // Forget programs nobody uses any more
+        for (auto it = cache.begin(); it != cache.end();)
+        {
+            vector<weak_ptr<const DecodedProgram>> &programs = it->second;
+            programs.erase(remove_if(programs.begin(), programs.end(),
+                                     [](const weak_ptr<const DecodedProgram> &program) { return program.expired(); }),
+                           programs.end());
+            if (programs.empty())
+                it = cache.erase(it);
+            else
+                ++it;
+        }
+        return decoded;
+    }
+
+    CodeSpace &space_of(const Core &core)
+    {
+        return code_spaces[core_space[core.core_id]];
+    }
+
+    // Points a code space at a program, dropping the translations built
+    // from whatever it held before
+    void set_program(CodeSpace &space, const vector<string> &source)
+    {
+        set_program(space, shared_program(source));
+    }
+
+    void set_program(CodeSpace &space, shared_ptr<const DecodedProgram> decoded)
+    {
+        const vector<string> &source = decoded->source;
+        space.program = decoded;
+        add_program_version(space);
+        space.modified.reset();
+        space.block_of.clear();
+        space.translated_blocks.clear();
+        space.block_at.assign(source.size(), -1);
+        int code_pages = (source.size() + CODE_PAGE_INSTRUCTIONS - 1) / CODE_PAGE_INSTRUCTIONS;
+        space.page_blocks.assign(code_pages, vector<int>());
+        space.code_page_dirty.assign(code_pages, false);
+        space.jit.flush();
+    }
+
+    // Reads the non-empty lines of an assembly file
+    static bool read_program(const string &filename, vector<string> &source)
+    {
+        ifstream file(filename);
+        if (!file.is_open())
+        {
+            cerr << "Error: Cannot open " << filename << endl;
+            return false;
+        }
+
+        string line;
+        while (getline(file, line))
+        {
+            if (!line.empty())
+            {
+                source.push_back(line);
+            }
+        }
+        return true;
+    }
+
+    // Makes space's current program its newest version. Versions no valid
+    // latch was fetched from are dropped, and the latches renumbered.
+    void add_program_version(CodeSpace &space)
+    {
+        int index = &space - code_spaces.data();
+        int oldest = space.versions.size();
+        for (const PipelineLatch *stage : {&fetch_stage, &decode_stage, &execute_stage, &memory_stage, &writeback_stage})
+        {
+            for (int i = 0; i < NUM_CORES; i++)
+            {
+                if (stage->valid[i] && stage->space[i] == index)
+                    oldest = min(oldest, stage->version[i]);
+            }
+        }
+        space.versions.erase(space.versions.begin(), space.versions.begin() + oldest);
+        for (PipelineLatch *stage : {&fetch_stage, &decode_stage, &execute_stage, &memory_stage, &writeback_stage})
+        {
+            for (int i = 0; i < NUM_CORES; i++)
+            {
+                if (stage->valid[i] && stage->space[i] == index)
+                    stage->version[i] -= oldest;
+            }
+        }
+        space.versions.push_back(space.program);
+    }
+
+    // Fetches the instruction for a given core into its fetch latch
+    void fetch(Core &core)
+    {
+        int id = core.core_id;
+        fetch_stage.valid[id] = true;
+        fetch_stage.pc[id] = core.pc;
+        fetch_stage.space[id] = core_space[id];
+        fetch_stage.version[id] = code_spaces[core_space[id]].versions.size() - 1;
+    }
+
+    // The predecoded instruction held in a core's latch
+    const Instruction &latched(const PipelineLatch &stage, int core_id) const
+    {
+        const CodeSpace &space = code_spaces[stage.space[core_id]];
+        return space.versions[stage.version[core_id]]->instructions[stage.pc[core_id] / 4];
+    }
+
+    // Moves a core's instruction from one latch to the next
+    static void advance(PipelineLatch &from, PipelineLatch &to, int core_id)
+    {
+        to.valid[core_id] = true;
+        to.pc[core_id] = from.pc[core_id];
+        to.space[core_id] = from.space[core_id];
+        to.version[core_id] = from.version[core_id];
+        from.valid[core_id] = false;
+    }
+
+    // Splits the predecoded program into basic blocks. Leaders are the entry
+    // point, branch/jump targets and the instructions following them.
+    // Fills the space's block_of with the block index of every instruction.
+    int find_basic_blocks(CodeSpace &space)
+    {
+        const DecodedProgram &program = *space.program;
+        int size = program.instructions.size();
+        vector<bool> leader(size, false);
+        if (size > 0)
+            leader[0] = true;
+        for (int i = 0; i < size; i++)
+        {
+            const Instruction &inst = program.instructions[i];
+            if (inst.kind == OP_BNE || inst.kind == OP_JAL)
+            {
+                int target_pc = i * 4 + inst.imm + (inst.kind == OP_JAL ? 4 : 0);
+                if (target_pc >= 0 && target_pc / 4 < size)
+                    leader[target_pc / 4] = true;
+                if (i + 1 < size)
+                    leader[i + 1] = true;
+            }
+        }
+
+        space.block_of.assign(size, 0);
+        int blocks = 0;
+        for (int i = 0; i < size; i++)
+        {
+            if (leader[i])
+                blocks++;
+            space.block_of[i] = blocks - 1;
+        }
+        return blocks;
+    }
+
+    // Translates the basic block starting at pc. Blocks end after a BNE or
+    // JAL, at the end of the program, or after MAX_BLOCK_LENGTH instructions.
+    TranslatedBlock &translate_block(CodeSpace &space, int pc)
+    {
+        static const int MAX_BLOCK_LENGTH = 64;
+        const DecodedProgram &program = *space.program;
+        const int program_size = program.instructions.size();
+
+        TranslatedBlock block;
+        block.start_pc = pc;
+        block.length = 0;
+        block.terminator = OP_NOP;
+        block.term_rd = block.term_rs1 = block.term_imm = 0;
+        block.valid = true;
+        block.executions = 0;
+
+        int cur = pc;
+        while (cur >= 0 && cur / 4 < program_size && block.length < MAX_BLOCK_LENGTH)
+        {
+            const Instruction &inst = program.instructions[cur / 4];
+            block.length++;
+            if (inst.kind == OP_BNE || inst.kind == OP_JAL)
+            {
+                block.terminator = inst.kind;
+                block.term_rd = inst.rd;
+                block.term_rs1 = inst.rs1;
+                block.term_imm = inst.imm;
+                break;
+            }
+
+            TranslatedOp op = {nullptr, inst.rd, inst.rs1, inst.rs2};
+            if (inst.kind == OP_ADD)
+                op.handler = op_add;
+            else if (inst.kind == OP_SUB)
+                op.handler = op_sub;
+            else if (inst.kind == OP_SWAP)
+                op.handler = op_swap;
+            if (op.handler)
+                block.body.push_back(op); // NOPs only count towards the length
+            cur += 4;
+        }
+
+        block_translations++;
+        int block_index = space.translated_blocks.size();
+        space.block_at[pc / 4] = block_index;
+        int first_page = pc / 4 / CODE_PAGE_INSTRUCTIONS;
+        int last_page = (pc / 4 + block.length - 1) / CODE_PAGE_INSTRUCTIONS;
+        for (int page = first_page; page <= last_page; page++)
+        {
+            space.page_blocks[page].push_back(block_index);
+        }
+        space.translated_blocks.push_back(block);
+        return space.translated_blocks.back();
+    }
+
+    // Store-address check for the code: marks the page dirty and, if any
+    // blocks were translated from it, drops them all
+    void code_page_written(CodeSpace &space, int index)
+    {
+        int page = index / CODE_PAGE_INSTRUCTIONS;
+        space.code_page_dirty[page] = true;
+        if (space.page_blocks[page].empty())
+            return;
+
+        space.jit.flush(); // Native blocks may be chained into the stale ones
+        for (int block_index : space.page_blocks[page])
+        {
+            TranslatedBlock &block = space.translated_blocks[block_index];
+            if (!block.valid)
+                continue;
+            block.valid = false;
+            code_invalidations++;
+            if (space.block_at[block.start_pc / 4] == block_index)
+                space.block_at[block.start_pc / 4] = -1;
+        }
+        space.page_blocks[page].clear();
+    }
+
+    static const int JIT_THRESHOLD = 16; // Block executions before native translation
+
+    // Functional execution through the translation cache: whole blocks run
+    // without per-instruction dispatch. The tail that doesn't fit in
+    // max_instructions is left to the per-instruction interpreter.
+    long long run_core_blocks(Core &core, long long max_instructions)
+    {
+        CodeSpace &space = space_of(core);
+        const int program_size = space.size();
+        int *regs = core.registers;
+        int pc = core.pc;
+        long long executed = 0;
+
+        while (pc >= 0 && pc / 4 < program_size)
+        {
+            int index = space.block_at[pc / 4];
+            TranslatedBlock *block = index >= 0 ? &space.translated_blocks[index] : nullptr;
+            if (!block || !block->valid || block->start_pc != pc)
+                block = &translate_block(space, pc);
+            if (max_instructions >= 0 && max_instructions - executed < block->length)
+                break;
+
+            // Hot blocks run as native code, chained until they leave
+            // translated code or the budget runs out
+            if (jit_enabled && block->executions >= JIT_THRESHOLD)
+            {
+                int block_index = space.block_at[pc / 4];
+                uint8_t *native = space.jit.lookup(block_index);
+                if (!native)
+                    native = space.jit.compile(block_index, *block);
+                if (native)
+                {
+                    long long budget = max_instructions >= 0 ? max_instructions - executed : LLONG_MAX;
+                    long long before = budget;
+                    pc = JitCodeCache::run(native, regs, budget);
+                    executed += before - budget;
+                    continue;
+                }
+            }
+            block->executions++;
+
+            const TranslatedOp *op = block->body.data();
+            const TranslatedOp *end = op + block->body.size();
+            for (; op != end; op++)
+            {
+                op->handler(regs, *op);
+            }
+
+            int term_pc = pc + 4 * (block->length - 1);
+            if (block->terminator == OP_BNE)
+                pc = (regs[block->term_rd] != regs[block->term_rs1]) ? term_pc + block->term_imm : term_pc + 4;
+            else if (block->terminator == OP_JAL)
+            {
+                regs[block->term_rd] = term_pc + 4;
+                pc = term_pc + block->term_imm + 4;
+            }
+            else
+                pc = term_pc + 4;
+            executed += block->length;
+        }
+
+        core.pc = pc;
+        return executed;
+    }
+
+    // Runs one core functionally for up to max_instructions (-1 = until it
+    // leaves the program), without pipeline stages, latencies or tracing.
+    // Follows the same path as the precise detailed pipeline; the original
+    // one diverges from it (see enable_precise_pipeline()). When profiling,
+    // block_counts is indexed by the core space's block_of.
+    long long run_core_functional(Core &core, long long max_instructions, long long *block_counts = nullptr)
+    {
+        long long executed = 0;
+        if (block_cache_enabled && !block_counts)
+            executed = run_core_blocks(core, max_instructions);
+
+        const CodeSpace &space = space_of(core);
+        const Instruction *code = space.program->instructions.data();
+        const int program_size = space.size();
+        int *regs = core.registers;
+        int pc = core.pc;
+
+        while (executed != max_instructions && pc >= 0 && pc / 4 < program_size)
+        {
+            const Instruction &inst = code[pc / 4];
+            if (block_counts)
+                block_counts[space.block_of[pc / 4]]++;
+            switch (inst.kind)
+            {
+            case OP_ADD:
+                regs[inst.rd] = regs[inst.rs1] + regs[inst.rs2];
+                pc += 4;
+                break;
+            case OP_SUB:
+                regs[inst.rd] = regs[inst.rs1] - regs[inst.rs2];
+                pc += 4;
+                break;
+            case OP_JAL:
+                // execute() adds imm and the pipeline then steps past the JAL
+                regs[inst.rd] = pc + 4;
+                pc += inst.imm + 4;
+                break;
+            case OP_BNE:
+                pc += (regs[inst.rd] != regs[inst.rs1]) ? inst.imm : 4;
+                break;
+            case OP_SWAP:
+                swap(regs[inst.rs1], regs[inst.rs2]);
+                pc += 4;
+                break;
+            default:
+                pc += 4;
+                break;
+            }
+            executed++;
+        }
+
+        core.pc = pc;
+        return executed;
+    }
+
+    // Decodes the instruction and performs register fetch
+    const Instruction &decode(const Instruction &instruction)
+    {
+        // This is where you would typically check for data dependencies
+        // and potential stalls.  For now, we'll just pass the instruction along.
+        return instruction;
+    }
+
+    // Executes the instruction (fetched from instruction_pc)
+    void execute(const Instruction &instruction, int instruction_pc, Core &core)
+    {
+        if (precise_pipeline)
+        {
+            execute_precise(instruction, instruction_pc, core);
+            return;
+        }
+        if (instruction.opcode == "JAL")
+        { // Jump and Link
+            if (is_valid_register(instruction.rd))
+            {
+                core.registers[instruction.rd] = instruction_pc + 4; // Store return address
+                core.pc += instruction.imm;
+            }
+        }
+        else if (instruction.opcode == "BNE")
+        { // Branch if Not Equal
+            if (is_valid_register(instruction.rd) && is_valid_register(instruction.rs1))
+            {
+                if (core.registers[instruction.rd] != core.registers[instruction.rs1])
+                {
+                    core.pc += instruction.imm;
+                }
+                else
+                {
+                    core.pc += 4;
+                }
+                return; // Important: Skip the default PC increment
+            }
+        }
+        else if (instruction.opcode == "ADD")
+        { // Addition
+            if (is_valid_register(instruction.rd) && is_valid_register(instruction.rs1) && is_valid_register(instruction.rs2))
+            {
+                core.registers[instruction.rd] = core.registers[instruction.rs1] + core.registers[instruction.rs2];
+            }
+        }
+        else if (instruction.opcode == "SUB")
+        { // Subtraction
+            if (is_valid_register(instruction.rd) && is_valid_register(instruction.rs1) && is_valid_register(instruction.rs2))
+            {
+                core.registers[instruction.rd] = core.registers[instruction.rs1] - core.registers[instruction.rs2];
+            }
+        }
+        else if (instruction.opcode == "SWAP")
+        { // Swap two registers
+            if (is_valid_register(instruction.rs1) && is_valid_register(instruction.rs2))
+            {
+                swap(core.registers[instruction.rs1], core.registers[instruction.rs2]);
+            }
+        }
+        core.pc += 4; // Default PC increment
+    }
+
+    // execute() for the precise pipeline: same effect on the registers,
+    // but the next PC is computed from instruction_pc like the functional
+    // engines do, and a redirect squashes the younger fetch and decode
+    // latches and refetches from the target
+    void execute_precise(const Instruction &instruction, int instruction_pc, Core &core)
+    {
+        int next_pc = instruction_pc + 4;
+        int *regs = core.registers;
+        switch (instruction.kind)
+        {
+        case OP_ADD:
+            regs[instruction.rd] = regs[instruction.rs1] + regs[instruction.rs2];
+            break;
+        case OP_SUB:
+            regs[instruction.rd] = regs[instruction.rs1] - regs[instruction.rs2];
+            break;
+        case OP_SWAP:
+            swap(regs[instruction.rs1], regs[instruction.rs2]);
+            break;
+        case OP_JAL:
+            regs[instruction.rd] = instruction_pc + 4;
+            next_pc = instruction_pc + instruction.imm + 4;
+            break;
+        case OP_BNE:
+            if (regs[instruction.rd] != regs[instruction.rs1])
+                next_pc = instruction_pc + instruction.imm;
+            break;
+        default:
+            break;
+        }
+        if (next_pc == instruction_pc + 4)
+            return;
+
+        int id = core.core_id;
+        if (trace_enabled && (fetch_stage.valid[id] || decode_stage.valid[id]))
+            trace_out(id) << "Core " << id << " - Squashed younger instructions, redirect to " << next_pc << endl;
+        // Squashed fetches don't count against the fetch budget, which
+        // therefore counts the instructions on the functional path
+        if (fetch_budget[id] >= 0)
+            fetch_budget[id] += fetch_stage.valid[id] + decode_stage.valid[id];
+        fetch_stage.valid[id] = false;
+        decode_stage.valid[id] = false;
+        core.stalled = false;
+        core.pc = next_pc;
+    }
+
+    // Memory access stage (currently empty)
+    void memory_access(const Instruction &instruction)
+    {
+        // Implement memory read/write operations here
+    }
+
+    // Writeback stage
+    void writeback(const Instruction &instruction, Core &core)
+    {
+        // This is where you write the result back to the register file.
+        // For now, it's empty as the execution directly updates registers.
+    }
+
+    // Checks for data dependencies and inserts stalls if necessary.
+    bool check_data_hazards(Core &core)
+    {
+        // Example: Check if the current instruction in the decode stage depends
+        // on a register being written to by an instruction in the execute or
+        // memory stage.
+        if (!decode_stage.valid[core.core_id])
+            return false;
+
+        const Instruction &decode_inst = latched(decode_stage, core.core_id);
+
+        // Check against execute stage
+        if (execute_stage.valid[core.core_id] && latched(execute_stage, core.core_id).rd != -1)
+        {
+            const Instruction &execute_inst = latched(execute_stage, core.core_id);
+            if ((decode_inst.rs1 == execute_inst.rd || decode_inst.rs2 == execute_inst.rd) && forwarding_enabled == false)
+            {
+                core_stalls[core.core_id]++;
+                return true; // Stall needed
+            }
+        }
+
+        // Check against memory stage
+        if (memory_stage.valid[core.core_id] && latched(memory_stage, core.core_id).rd != -1)
+        {
+            const Instruction &memory_inst = latched(memory_stage, core.core_id);
+            if ((decode_inst.rs1 == memory_inst.rd || decode_inst.rs2 == memory_inst.rd) && forwarding_enabled == false)
+            {
+                core_stalls[core.core_id]++;
+                return true; // Stall needed
+            }
+        }
+
+        // Check against writeback stage
+        if (writeback_stage.valid[core.core_id] && latched(writeback_stage, core.core_id).rd != -1)
+        {
+            const Instruction &writeback_inst = latched(writeback_stage, core.core_id);
+            if ((decode_inst.rs1 == writeback_inst.rd || decode_inst.rs2 == writeback_inst.rd) && forwarding_enabled == false)
+            {
+                core_stalls[core.core_id]++;
+                return true; // Stall needed
+            }
+        }
+
+        return false; // No stall needed
+    }
+
+    // Performs data forwarding if enabled
+    void perform_data_forwarding(Core &core)
+    {
+        if (!decode_stage.valid[core.core_id])
+            return;
+
+        const Instruction &decode_inst = latched(decode_stage, core.core_id);
+
+        // Forward from execute stage
+        if (execute_stage.valid[core.core_id] && latched(execute_stage, core.core_id).rd != -1)
+        {
+            const Instruction &execute_inst = latched(execute_stage, core.core_id);
+            if (decode_inst.rs1 == execute_inst.rd)
+            {
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Data forwarding: Core " << core.core_id << ", forwarding from execute to decode for register x" << decode_inst.rs1 << endl;
+            }
+            if (decode_inst.rs2 == execute_inst.rd)
+            {
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Data forwarding: Core " << core.core_id << ", forwarding from execute to decode for register x" << decode_inst.rs2 << endl;
+            }
+        }
+
+        // Forward from memory stage
+        if (memory_stage.valid[core.core_id] && latched(memory_stage, core.core_id).rd != -1)
+        {
+            const Instruction &memory_inst = latched(memory_stage, core.core_id);
+            if (decode_inst.rs1 == memory_inst.rd)
+            {
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Data forwarding: Core " << core.core_id << ", forwarding from memory to decode for register x" << decode_inst.rs1 << endl;
+            }
+            if (decode_inst.rs2 == memory_inst.rd)
+            {
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Data forwarding: Core " << core.core_id << ", forwarding from memory to decode for register x" << decode_inst.rs2 << endl;
+            }
+        }
+
+        // Forward from writeback stage
+        if (writeback_stage.valid[core.core_id] && latched(writeback_stage, core.core_id).rd != -1)
+        {
+            const Instruction &writeback_inst = latched(writeback_stage, core.core_id);
+            if (decode_inst.rs1 == writeback_inst.rd)
+            {
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Data forwarding: Core " << core.core_id << ", forwarding from writeback to decode for register x" << decode_inst.rs1 << endl;
+            }
+            if (decode_inst.rs2 == writeback_inst.rd)
+            {
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Data forwarding: Core " << core.core_id << ", forwarding from writeback to decode for register x" << decode_inst.rs2 << endl;
+            }
+        }
+    }
+
+    // True if the core may still fetch a new instruction
+    bool can_fetch(const Core &core)
+    {
+        return core.pc >= 0 && core.pc / 4 < space_of(core).program->source.size() && fetch_budget[core.core_id] != 0;
+    }
+
+    // True if the core can fetch or still has instructions in flight
+    bool core_active(const Core &core)
+    {
+        int id = core.core_id;
+        return can_fetch(core) ||
+               fetch_stage.valid[id] ||
+               decode_stage.valid[id] ||
+               execute_stage.valid[id] ||
+               memory_stage.valid[id] ||
+               writeback_stage.valid[id];
+    }
+
+    bool any_core_in_program()
+    {
+        for (auto &core : cores)
+        {
+            if (core.pc / 4 < space_of(core).program->source.size())
+                return true;
+        }
+        return false;
+    }
+
+    // True if some core still has fetch budget left and could use it: it can
+    // fetch now, or an instruction in flight may still redirect it back
+    // into the program
+    bool any_core_can_fetch()
+    {
+        for (auto &core : cores)
+        {
+            if (fetch_budget[core.core_id] != 0 && core_active(core))
+                return true;
+        }
+        return false;
+    }
+
+    // Advances one core's pipeline by one cycle
+    void step_core(Core &core)
+    {
+        // Writeback Stage
+        if (writeback_stage.valid[core.core_id])
+        {
+            if (trace_enabled)
+                trace_out(core.core_id) << "Core " << core.core_id << " - Writeback: " << latched(writeback_stage, core.core_id).opcode << endl;
+            writeback(latched(writeback_stage, core.core_id), core);
+            writeback_stage.valid[core.core_id] = false;
+            core_retired[core.core_id]++;
+        }
+
+        // Memory Stage
+        if (memory_stage.valid[core.core_id])
+        {
+            if (trace_enabled)
+                trace_out(core.core_id) << "Core " << core.core_id << " - Memory: " << latched(memory_stage, core.core_id).opcode << endl;
+            memory_access(latched(memory_stage, core.core_id));
+            advance(memory_stage, writeback_stage, core.core_id);
+        }
+
+        // Execute Stage
+        if (execute_stage.valid[core.core_id])
+        {
+            // Check if the instruction has finished its latency
+            if (latency_counter[core.core_id] > 1)
+            {
+                latency_counter[core.core_id]--;
+            }
+            else
+            {
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Core " << core.core_id << " - Execute: " << latched(execute_stage, core.core_id).opcode << endl;
+                execute(latched(execute_stage, core.core_id), execute_stage.pc[core.core_id], core);
+                advance(execute_stage, memory_stage, core.core_id);
+            }
+        }
+
+        // Decode Stage (the precise pipeline holds it behind a busy execute)
+        if (decode_stage.valid[core.core_id] && !(precise_pipeline && execute_stage.valid[core.core_id]))
+        {
+            if (forwarding_enabled)
+            {
+                perform_data_forwarding(core);
+            }
+            if (trace_enabled)
+                trace_out(core.core_id) << "Core " << core.core_id << " - Decode: " << latched(decode_stage, core.core_id).opcode << endl;
+            const Instruction &decoded_instruction = decode(latched(decode_stage, core.core_id));
+            advance(decode_stage, execute_stage, core.core_id);
+            auto latency = instruction_latencies.find(decoded_instruction.opcode);
+            latency_counter[core.core_id] = latency != instruction_latencies.end() ? latency->second : 0;
+        }
+
+        // Fetch Stage
+        if (fetch_stage.valid[core.core_id] && !(precise_pipeline && decode_stage.valid[core.core_id]))
+        {
+            // Check for data hazards before moving to the decode stage
+            if (check_data_hazards(core))
+            {
+                core.stalled = true;
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Core " << core.core_id << " - Stalled at Fetch due to data hazard" << endl;
+                return;
+            }
+            else
+            {
+                core.stalled = false;
+                if (trace_enabled)
+                    trace_out(core.core_id) << "Core " << core.core_id << " - Fetch: " << latched(fetch_stage, core.core_id).opcode << endl;
+                advance(fetch_stage, decode_stage, core.core_id);
+            }
+        }
+
+        // Fetch new instruction if the core is not stalled
+        if (!core.stalled && can_fetch(core) && !(precise_pipeline && fetch_stage.valid[core.core_id]))
+        {
+            fetch(core);
+            core.pc += 4; // Increment PC after fetching
+            if (fetch_budget[core.core_id] > 0)
+                fetch_budget[core.core_id]--;
+        }
+    }
+
+    // True if the core's next cycle would only count down the latency of
+    // the instruction in execute: nothing else is in flight and no new
+    // instruction can be fetched.
+    bool core_waiting_on_latency(const Core &core)
+    {
+        int id = core.core_id;
+        return execute_stage.valid[id] && latency_counter[id] > 1 &&
+               !fetch_stage.valid[id] && !decode_stage.valid[id] &&
+               !memory_stage.valid[id] && !writeback_stage.valid[id] &&
+               (core.stalled || !can_fetch(core));
+    }
+
+    // If every active core is only waiting on an execute latency, advances
+    // time straight to the cycle in which the first of them completes. The
+    // skipped cycles would have changed nothing but the counters and print
+    // no trace, so results are identical to stepping through them. Skips at
+    // most max_skip cycles.
+    void skip_latency_cycles(long long max_skip)
+    {
+        long long skip = max_skip;
+        for (auto &core : cores)
+        {
+            if (!core_active(core))
+                continue;
+            if (!core_waiting_on_latency(core))
+                return;
+            skip = min(skip, (long long)latency_counter[core.core_id] - 1);
+        }
+        if (skip <= 0)
+            return;
+
+        total_cycles += skip;
+        for (auto &core : cores)
+        {
+            if (core_active(core))
+                latency_counter[core.core_id] -= skip;
+        }
+    }
+
+    // Clock edge of one core's pipeline as a component of the event queue.
+    // The core reschedules itself while it has work and sleeps through
+    // cycles in which it only waits on an execute latency.
+    void tick_core(int id, EventQueue &queue)
+    {
+        Core &core = cores[id];
+        step_core(core);
+        if (trace_buffers[id] && trace_buffers[id]->text.tellp() > 0)
+        {
+            trace_buffers[id]->cycles.emplace_back(queue.time(), trace_buffers[id]->text.str());
+            trace_buffers[id]->text.str("");
+        }
+        if (!core_active(core))
+            return;
+
+        long long next = queue.time() + 1;
+        if (cycle_skipping_enabled && core_waiting_on_latency(core))
+        {
+            next += latency_counter[id] - 1;
+            latency_counter[id] = 1;
+        }
+        schedule_tick(queue, next, id);
+    }
+
+    // Schedules a clock edge of core id's pipeline on queue
+    void schedule_tick(EventQueue &queue, long long time, int id)
+    {
+        queue.schedule(time, id, [this, &queue, id]() { tick_core(id, queue); });
+    }
+
+    // Prints the captured trace of all cores in cycle order, and core order
+    // within a cycle, exactly as the serial engine would have printed it
+    void flush_trace_buffers(vector<CoreTraceBuffer> &buffers)
+    {
+        vector<pair<long long, const string *>> lines;
+        for (auto &buffer : buffers)
+        {
+            for (auto &cycle : buffer.cycles)
+                lines.emplace_back(cycle.first, &cycle.second);
+        }
+        stable_sort(lines.begin(), lines.end(),
+                    [](const pair<long long, const string *> &a, const pair<long long, const string *> &b)
+                    { return a.first < b.first; });
+        for (auto &line : lines)
+            cout << *line.second;
+        cout.flush();
+        for (auto &buffer : buffers)
+            buffer.cycles.clear();
+    }
+
+    // Parallel discrete-event simulation. The cores are split into
+    // partitions of cores_per_partition consecutive cores, each with its own
+    // event queue and host thread. Partitions advance in conservative
+    // windows: none runs an event more than lookahead cycles past the
+    // earliest pending event of the whole system, which is safe as long as
+    // lookahead does not exceed the latency of any link between partitions.
+    // The pipelines share no timed state today, so any lookahead is safe; it
+    // only sets how often the trace is merged. Results and trace match
+    // run_serial().
+    void run_parallel(int cores_per_partition, long long lookahead)
+    {
+        cores_per_partition = max(1, min(cores_per_partition, NUM_CORES));
+        lookahead = max(1LL, lookahead);
+        int partitions = (NUM_CORES + cores_per_partition - 1) / cores_per_partition;
+
+        vector<EventQueue> queues(partitions);
+        vector<CoreTraceBuffer> buffers(trace_enabled ? NUM_CORES : 0);
+        for (size_t i = 0; i < buffers.size(); i++)
+            trace_buffers[i] = &buffers[i];
+
+        for (auto &core : cores)
+        {
+            if (core_active(core))
+            {
+                schedule_tick(queues[core.core_id / cores_per_partition], total_cycles + 1, core.core_id);
+                idle_cycle_counted = false;
+            }
+        }
+
+        // Between windows (one thread at a time): publish the trace and
+        // open the next window from the earliest pending event
+        long long window_end = 0;
+        bool done = false;
+        auto next_window = [&]()
+        {
+            if (!buffers.empty())
+                flush_trace_buffers(buffers);
+            long long earliest = LLONG_MAX;
+            for (auto &queue : queues)
+                earliest = min(earliest, queue.next_time());
+            done = earliest == LLONG_MAX;
+            if (!done)
+                window_end = earliest + lookahead;
+        };
+        next_window();
+
+        mutex window_mutex;
+        condition_variable window_changed;
+        int arrived = 0;
+        long long generation = 0;
+        auto barrier = [&]()
+        {
+            unique_lock<mutex> lock(window_mutex);
+            long long my_generation = generation;
+            if (++arrived == partitions)
+            {
+                arrived = 0;
+                generation++;
+                window_changed.notify_all();
+            }
+            else
+            {
+                window_changed.wait(lock, [&]() { return generation != my_generation; });
+            }
+        };
+
+        auto run_partition = [&](int p)
+        {
+            while (!done)
+            {
+                while (queues[p].run_next(window_end))
+                {
+                }
+                barrier();
+                if (p == 0)
+                    next_window();
+                barrier();
+            }
+        };
+
+        vector<thread> threads;
+        for (int p = 1; p < partitions; p++)
+            threads.emplace_back(run_partition, p);
+        run_partition(0);
+        for (auto &t : threads)
+            t.join();
+
+        for (auto &queue : queues)
+            total_cycles = max(total_cycles, queue.time());
+        fill(begin(trace_buffers), end(trace_buffers), nullptr);
+        count_idle_cycle();
+    }
+
+    // Simulator each host thread reuses from batch job to batch job
+    static unique_ptr<RiscVSimulator> &batch_simulator()
+    {
+        thread_local unique_ptr<RiscVSimulator> reused;
+        return reused;
+    }
+
+    // Runs one batch job on the calling thread's batch simulator, reset to
+    // the state right after loading the job's program
+    static SimulationStats run_job(const SimulationJob &job, shared_ptr<const DecodedProgram> program)
+    {
+        unique_ptr<RiscVSimulator> &reused = batch_simulator();
+        if (!reused || reused->memory.size() != (size_t)job.memory_words)
+            reused.reset(new RiscVSimulator(job.memory_words));
+        RiscVSimulator &simulator = *reused;
+        if (simulator.code_spaces[0].program != program)
+            simulator.set_program(simulator.code_spaces[0], program);
+        simulator.reset();
+        simulator.trace_enabled = false;
+        simulator.forwarding_enabled = job.forwarding;
+        simulator.instruction_latencies.clear();
+        simulator.set_default_latencies();
+        for (auto &latency : job.latencies)
+            simulator.instruction_latencies[latency.first] = latency.second;
+
+        return simulator.run_to_stats(job.max_instructions);
+    }
+
+    // Runs the detailed pipeline to completion, or for max_instructions more
+    // instructions per core, and returns the statistics record
+    SimulationStats run_to_stats(long long max_instructions)
+    {
+        if (max_instructions < 0)
+            run_serial();
+        else
+            run_detailed(max_instructions);
+
+        return statistics();
+    }
+
+    // Runs one what-if variant in a forked child, which shares the parent's
+    // pages copy-on-write, and returns the pipe its statistics arrive on
+    // (-1 if the child could not be started)
+    int fork_variant(const function<void(RiscVSimulator &)> &variant, long long max_instructions, int &child)
+    {
+#if FORK_SUPPORTED
+        int fds[2];
+        if (pipe(fds) != 0)
+            return -1;
+        cout.flush();
+        child = fork();
+        if (child < 0)
+        {
+            close(fds[0]);
+            close(fds[1]);
+            return -1;
+        }
+        if (child == 0)
+        {
+            close(fds[0]);
+            trace_enabled = false;
+            variant(*this);
+            SimulationStats stats = run_to_stats(max_instructions);
+            cout.flush();
+            const char *bytes = reinterpret_cast<const char *>(&stats);
+            size_t written = 0;
+            while (written < sizeof(stats))
+            {
+                ssize_t n = write(fds[1], bytes + written, sizeof(stats) - written);
+                if (n <= 0)
+                    _exit(1);
+                written += n;
+            }
+            _exit(0);
+        }
+        close(fds[1]);
+        return fds[0];
+#else
+        (void)variant;
+        (void)max_instructions;
+        (void)child;
+        return -1;
+#endif
+    }
+
+    // Collects the statistics of a child started by fork_variant()
+    static bool join_variant(int fd, int child, SimulationStats &stats)
+    {
+#if FORK_SUPPORTED
+        char *bytes = reinterpret_cast<char *>(&stats);
+        size_t received = 0;
+        while (received < sizeof(stats))
+        {
+            ssize_t n = read(fd, bytes + received, sizeof(stats) - received);
+            if (n <= 0)
+                break;
+            received += n;
+        }
+        close(fd);
+        int status = 0;
+        waitpid(child, &status, 0);
+        return received == sizeof(stats) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#else
+        (void)fd;
+        (void)child;
+        (void)stats;
+        return false;
+#endif
+    }
+
+    // Waits until one of the what-if children's pipes delivers its statistics
+    // (or closes) and returns its position in fds
+    static size_t next_finished_variant(const vector<int> &fds)
+    {
+#if FORK_SUPPORTED
+        vector<pollfd> polled;
+        for (int fd : fds)
+            polled.push_back({fd, POLLIN, 0});
+        while (poll(polled.data(), polled.size(), -1) < 0)
+        {
+            if (errno != EINTR)
+                return 0; // Fall back to waiting for the oldest child
+        }
+        for (size_t i = 0; i < polled.size(); i++)
+        {
+            if (polled[i].revents != 0)
+                return i;
+        }
+#else
+        (void)fds;
+#endif
+        return 0;
+    }
+
+    // True if threads other than the caller run in this process. A child
+    // forked then could inherit a lock (e.g. the allocator's) held by one
+    // of them and deadlock. Only Linux can tell; elsewhere returns false.
+    static bool other_threads_running()
+    {
+#ifdef __linux__
+        ifstream status("/proc/self/status");
+        string line;
+        while (getline(status, line))
+        {
+            if (line.compare(0, 8, "Threads:") == 0)
+                return atoi(line.c_str() + 8) > 1;
+        }
+#endif
+        return false;
+    }
+
+    // Memoization key of a sweep point: FNV-1a over the model version, the
+    // program text and every configuration field of the job that can change
+    // its statistics (the memory size can't: the pipeline never accesses it)
+    static uint64_t sweep_key(const vector<string> &source, const SimulationJob &job)
+    {
+        ostringstream config;
+        config << "model " << SWEEP_MODEL_VERSION << '\n';
+        for (auto &line : source)
+            config << line << '\n';
+        for (auto &latency : job.latencies)
+            config << latency.first << '=' << latency.second << ' ';
+        config << job.forwarding << ' ' << job.max_instructions;
+
+        uint64_t hash = 14695981039346656037ULL;
+        for (unsigned char c : config.str())
+        {
+            hash ^= c;
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    // Sweep cache file: one line per point, key followed by its statistics
+    static void save_sweep_result(ostream &out, uint64_t key, const SimulationStats &stats)
+    {
+        out << key << " " << stats.loaded << " " << stats.cycles << " " << stats.stalls << " "
+            << stats.instructions << " " << setprecision(17) << stats.cpi;
+        for (int i = 0; i < NUM_CORES; i++)
+        {
+            for (int r = 0; r < 32; r++)
+                out << " " << stats.registers[i][r];
+        }
+        out << '\n';
+    }
+
+    static void load_sweep_cache(const string &filename, map<uint64_t, SimulationStats> &cache)
+    {
+        ifstream file(filename);
+        string line;
+        while (getline(file, line))
+        {
+            istringstream in(line);
+            uint64_t key;
+            SimulationStats stats;
+            in >> key >> stats.loaded >> stats.cycles >> stats.stalls >> stats.instructions >> stats.cpi;
+            for (int i = 0; i < NUM_CORES; i++)
+            {
+                for (int r = 0; r < 32; r++)
+                    in >> stats.registers[i][r];
+            }
+            if (in)
+                cache[key] = stats;
+        }
+    }
+
+    // Binary checkpoint fields, in host byte order
+    template <typename T>
+    static void write_pod(ostream &out, const T &value)
+    {
+        out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+
+    template <typename T>
+    static bool read_pod(istream &in, T &value)
+    {
+        return (bool)in.read(reinterpret_cast<char *>(&value), sizeof(T));
+    }
+
+    static void write_string(ostream &out, const string &text)
+    {
+        write_pod(out, (uint32_t)text.size());
+        out.write(text.data(), text.size());
+    }
+
+    // Bytes left in a checkpoint stream; sizes read from a file are checked
+    // against it before anything is allocated
+    static uint64_t bytes_left(istream &in)
+    {
+        streampos here = in.tellg();
+        in.seekg(0, ios::end);
+        streampos end = in.tellg();
+        in.seekg(here);
+        return (here < 0 || end < here) ? 0 : (uint64_t)(end - here);
+    }
+
+    static bool read_string(istream &in, string &text)
+    {
+        uint32_t length;
+        if (!read_pod(in, length) || length > bytes_left(in))
+            return false;
+        text.resize(length);
+        return length == 0 || (bool)in.read(&text[0], length);
+    }
+
+    static void write_latch(ostream &out, const PipelineLatch &latch)
+    {
+        write_pod(out, latch.valid);
+        write_pod(out, latch.pc);
+    }
+
+    static bool read_latch(istream &in, PipelineLatch &latch)
+    {
+        return read_pod(in, latch.valid) && read_pod(in, latch.pc);
+    }
+
+    // Reads a checkpoint's header and memory into backing, leaving in at the
+    // rest of the state. Pages stored as unchanged are taken from the parent
+    // checkpoint, following the chain of incremental checkpoints, whose
+    // files are appended to chain. Each failure is reported once, by the
+    // checkpoint it occurs in and by the one being loaded.
+    static bool read_checkpoint_memory(const string &filename, istream &in, MemoryBacking &backing, bool huge,
+                                       vector<string> &chain)
+    {
+        chain.push_back(filename);
+        char magic[sizeof(CHECKPOINT_MAGIC)];
+        int32_t core_count = 0;
+        if (!in.read(magic, sizeof(magic)) || memcmp(magic, CHECKPOINT_MAGIC, sizeof(magic)) != 0 ||
+            !read_pod(in, core_count) || core_count != NUM_CORES)
+        {
+            cerr << "Error: " << filename << " is not a checkpoint of this simulator" << endl;
+            return false;
+        }
+
+        string parent;
+        uint64_t words = 0;
+        // Addresses are ints, and every page takes at least its kind byte
+        bool ok = read_string(in, parent) && read_pod(in, words) && words <= (uint64_t)INT_MAX &&
+                  (words + MemoryBacking::PAGE_WORDS - 1) / MemoryBacking::PAGE_WORDS <= bytes_left(in);
+        MemoryBacking restored(ok ? words : 0, huge);
+        vector<size_t> parent_pages;
+        for (size_t page = 0; ok && page < restored.pages(); page++)
+        {
+            uint8_t kind = 0;
+            ok = read_pod(in, kind);
+            if (kind == PAGE_DATA)
+                ok = ok && in.read(reinterpret_cast<char *>(restored.writable_page(page)),
+                                   restored.page_size(page) * sizeof(int));
+            else if (kind == PAGE_PARENT)
+                parent_pages.push_back(page);
+            else
+                ok = ok && kind == PAGE_ZERO;
+        }
+        if (!ok)
+        {
+            cerr << "Error: " << filename << " is truncated or corrupt" << endl;
+            return false;
+        }
+
+        if (!parent_pages.empty())
+        {
+            ifstream parent_in(parent, ios::binary);
+            MemoryBacking base;
+            bool restored_parent = false;
+            if (parent.empty() || !parent_in.is_open())
+                cerr << "Error: Cannot open parent checkpoint " << parent << " of " << filename << endl;
+            else if (find(chain.begin(), chain.end(), parent) != chain.end())
+                cerr << "Error: Checkpoint chain loops back to " << parent << " in " << filename << endl;
+            else if (chain.size() > MAX_CHECKPOINT_CHAIN)
+                cerr << "Error: Checkpoint chain is longer than " << MAX_CHECKPOINT_CHAIN << " at " << filename << endl;
+            else
+                restored_parent = read_checkpoint_memory(parent, parent_in, base, huge, chain) && base.size() == words;
+            if (!restored_parent)
+            {
+                if (chain.front() == filename)
+                    cerr << "Error: Cannot restore " << filename << " without its parent checkpoint " << parent << endl;
+                return false;
+            }
+            for (size_t page : parent_pages)
+                memcpy(restored.writable_page(page), base.page_words(page), restored.page_size(page) * sizeof(int));
+        }
+        backing.swap(restored);
+        return true;
+    }
+
+    // The serial execute() loop
+    void run_serial()
+    {
+        while (step_cycle())
+        {
+        }
+        count_idle_cycle();
+    }
+
+    // Counts the cycle in which every core was found idle, once per run,
+    // so every engine and API reports the same total
+    void count_idle_cycle()
+    {
+        if (!idle_cycle_counted)
+            total_cycles++;
+        idle_cycle_counted = true;
+    }
+
+    // Lists every difference in architectural state, pipeline state and
+    // statistics between this simulator and other
+    vector<string> compare_state(const RiscVSimulator &other) const
+    {
+        vector<string> differences;
+        auto check = [&](bool same, const string &what)
+        {
+            if (!same)
+                differences.push_back(what);
+        };
+
+        for (int i = 0; i < NUM_CORES; i++)
+        {
+            const Core &a = cores[i];
+            const Core &b = other.cores[i];
+            string core = "core " + to_string(i) + " ";
+            for (int r = 0; r < 32; r++)
+                check(a.registers[r] == b.registers[r], core + "x" + to_string(r));
+            check(a.pc == b.pc, core + "pc");
+            check(a.stalled == b.stalled, core + "stall flag");
+            check(fetch_stage.valid[i] == other.fetch_stage.valid[i] &&
+                      decode_stage.valid[i] == other.decode_stage.valid[i] &&
+                      execute_stage.valid[i] == other.execute_stage.valid[i] &&
+                      memory_stage.valid[i] == other.memory_stage.valid[i] &&
+                      writeback_stage.valid[i] == other.writeback_stage.valid[i],
+                  core + "pipeline latches");
+            check(latency_counter[i] == other.latency_counter[i], core + "execute latency");
+            check(core_stalls[i] == other.core_stalls[i], core + "stalls");
+            check(core_retired[i] == other.core_retired[i], core + "retired instructions");
+        }
+        check(memory.size() == other.memory.size(), "memory size");
+        for (size_t i = 0; i < memory.size() && i < other.memory.size(); i++)
+            check(memory[i] == other.memory[i], "memory word " + to_string(i));
+        check(total_cycles == other.total_cycles, "total cycles");
+        return differences;
+    }
+
+    // Simulates one clock cycle on every active core, after skipping up to
+    // max_cycles - 1 cycles that only count down latencies. Returns false,
+    // without counting a cycle, once no core has anything left to do.
+    bool step_cycle(long long max_cycles = LLONG_MAX)
+    {
+        bool cores_active = false;
+        for (auto &core : cores)
+        {
+            if (core_active(core))
+            {
+                cores_active = true;
+                break;
+            }
+        }
+        if (!cores_active)
+            return false;
+
+        if (cycle_skipping_enabled)
+            skip_latency_cycles(max_cycles - 1);
+
+        total_cycles++;
+        idle_cycle_counted = false;
+
+        // Iterate through each core and process the pipeline stages
+        for (auto &core : cores)
+        {
+            if (core_active(core))
+            {
+                step_core(core);
+            }
+        }
+        return true;
+    }
+
+    // Default instruction latencies
+    void set_default_latencies()
+    {
+        instruction_latencies["ADD"] = 1;
+        instruction_latencies["SUB"] = 1;
+        instruction_latencies["JAL"] = 1;
+        instruction_latencies["BNE"] = 1;
+        instruction_latencies["SWAP"] = 1;
+    }
+
+    // Returns cores, pipeline latches and memory to their initial state.
+    // Loaded program, configuration and statistics are kept.
+    void reset_architectural_state()
+    {
+        for (int i = 0; i < NUM_CORES; i++)
+        {
+            cores[i] = Core(i);
+            cores[i].pc = entry_pc[i];
+            latency_counter[i] = 0;
+            fetch_budget[i] = -1;
+        }
+        fetch_stage = PipelineLatch();
+        decode_stage = PipelineLatch();
+        execute_stage = PipelineLatch();
+        memory_stage = PipelineLatch();
+        writeback_stage = PipelineLatch();
+        memory.zero();
+    }
+
+    // Squared distance between two vectors
+    static double distance2(const vector<double> &a, const vector<double> &b)
+    {
+        double d = 0.0;
+        for (size_t i = 0; i < a.size(); i++)
+        {
+            d += (a[i] - b[i]) * (a[i] - b[i]);
+        }
+        return d;
+    }
+
+    // k-means with k-means++ seeding. Returns the BIC score of the clustering
+    // (as used by SimPoint) and fills assignment and centroids.
+    static double kmeans(const vector<vector<double>> &points, int k, mt19937 &rng,
+                         vector<int> &assignment, vector<vector<double>> &centroids)
+    {
+        int n = points.size();
+        int dims = points[0].size();
+
+        centroids.assign(1, points[rng() % n]);
+        vector<double> nearest(n);
+        while ((int)centroids.size() < k)
+        {
+            double total = 0.0;
+            for (int i = 0; i < n; i++)
+            {
+                nearest[i] = distance2(points[i], centroids[0]);
+                for (size_t c = 1; c < centroids.size(); c++)
+                {
+                    nearest[i] = min(nearest[i], distance2(points[i], centroids[c]));
+                }
+                total += nearest[i];
+            }
+            double pick = uniform_real_distribution<double>(0.0, total)(rng);
+            int chosen = n - 1;
+            for (int i = 0; i < n; i++)
+            {
+                pick -= nearest[i];
+                if (pick <= 0.0)
+                {
+                    chosen = i;
+                    break;
+                }
+            }
+            centroids.push_back(points[chosen]);
+        }
+
+        assignment.assign(n, -1);
+        for (int iteration = 0; iteration < 100; iteration++)
+        {
+            bool changed = false;
+            for (int i = 0; i < n; i++)
+            {
+                int best = 0;
+                for (int c = 1; c < k; c++)
+                {
+                    if (distance2(points[i], centroids[c]) < distance2(points[i], centroids[best]))
+                        best = c;
+                }
+                if (assignment[i] != best)
+                {
+                    assignment[i] = best;
+                    changed = true;
+                }
+            }
+            if (!changed)
+                break;
+
+            vector<vector<double>> sums(k, vector<double>(dims, 0.0));
+            vector<int> counts(k, 0);
+            for (int i = 0; i < n; i++)
+            {
+                counts[assignment[i]]++;
+                for (int d = 0; d < dims; d++)
+                {
+                    sums[assignment[i]][d] += points[i][d];
+                }
+            }
+            for (int c = 0; c < k; c++)
+            {
+                if (counts[c] == 0)
+                    continue; // Keep the old centroid for an empty cluster
+                for (int d = 0; d < dims; d++)
+                {
+                    centroids[c][d] = sums[c][d] / counts[c];
+                }
+            }
+        }
+
+        // Bayesian Information Criterion of the spherical Gaussian model
+        vector<int> counts(k, 0);
+        double distortion = 0.0;
+        for (int i = 0; i < n; i++)
+        {
+            counts[assignment[i]]++;
+            distortion += distance2(points[i], centroids[assignment[i]]);
+        }
+        double variance = n > k ? distortion / (n - k) : 0.0;
+        if (variance <= 0.0)
+            variance = 1e-12;
+        double likelihood = 0.0;
+        for (int c = 0; c < k; c++)
+        {
+            double r = counts[c];
+            if (r == 0)
+                continue;
+            likelihood += -r / 2.0 * log(2.0 * acos(-1.0)) - r * dims / 2.0 * log(variance) -
+                          (r - k) / 2.0 + r * log(r) - r * log((double)n);
+        }
+        double parameters = (k - 1) + dims * k + 1;
+        return likelihood - parameters / 2.0 * log((double)n);
+    }
+
+    // Emits the AOT translation of one code space, naming everything with
+    // prefix. Returns the number of basic blocks.
+    int emit_cpp_program(ostream &out, CodeSpace &space, const string &prefix)
+    {
+        const DecodedProgram &program = *space.program;
+        int size = program.instructions.size();
+        int blocks = find_basic_blocks(space);
+        vector<int> block_start(blocks, -1);
+        vector<int> block_end(blocks, -1);
+        for (int i = 0; i < size; i++)
+        {
+            if (block_start[space.block_of[i]] < 0)
+                block_start[space.block_of[i]] = i;
+            block_end[space.block_of[i]] = i;
+        }
+
+        // Single-instruction fallback used for PCs that don't start a block
+        out << "static int " << prefix << "step_instruction(int *x, int pc)\n{\n"
+            << "    executed++;\n"
+            << "    switch (pc / 4)\n    {\n";
+        for (int i = 0; i < size; i++)
+        {
+            const Instruction &inst = program.instructions[i];
+            out << "    case " << i << ":\n";
+            switch (inst.kind)
+            {
+            case OP_ADD:
+                out << "        x[" << inst.rd << "] = x[" << inst.rs1 << "] + x[" << inst.rs2 << "];\n";
+                break;
+            case OP_SUB:
+                out << "        x[" << inst.rd << "] = x[" << inst.rs1 << "] - x[" << inst.rs2 << "];\n";
+                break;
+            case OP_SWAP:
+                out << "        { int t = x[" << inst.rs1 << "]; x[" << inst.rs1 << "] = x[" << inst.rs2 << "]; x["
+                    << inst.rs2 << "] = t; }\n";
+                break;
+            case OP_JAL:
+                out << "        x[" << inst.rd << "] = pc + 4;\n"
+                    << "        return pc + " << inst.imm + 4 << ";\n";
+                continue;
+            case OP_BNE:
+                out << "        return x[" << inst.rd << "] != x[" << inst.rs1 << "] ? pc + " << inst.imm << " : pc + 4;\n";
+                continue;
+            default:
+                break;
+            }
+            out << "        return pc + 4;\n";
+        }
+        out << "    }\n    return -1;\n}\n\n";
+
+        for (int b = 0; b < blocks; b++)
+        {
+            int first = block_start[b];
+            int last = block_end[b];
+
+            // Registers touched by the block become locals
+            vector<bool> used(32, false);
+            vector<bool> written(32, false);
+            for (int i = first; i <= last; i++)
+            {
+                const Instruction &inst = program.instructions[i];
+                if (inst.kind == OP_NOP)
+                    continue;
+                if (inst.kind != OP_SWAP)
+                    used[inst.rd] = true;
+                if (inst.kind != OP_JAL)
+                    used[inst.rs1] = true;
+                if (inst.kind == OP_ADD || inst.kind == OP_SUB || inst.kind == OP_SWAP)
+                    used[inst.rs2] = true;
+                if (inst.kind == OP_ADD || inst.kind == OP_SUB || inst.kind == OP_JAL)
+                    written[inst.rd] = true;
+                if (inst.kind == OP_SWAP)
+                    written[inst.rs1] = written[inst.rs2] = true;
+            }
+
+            out << "// Instructions " << first << "-" << last << "\n"
+                << "static int " << prefix << "block_" << first * 4 << "(int *x)\n{\n";
+            for (int r = 0; r < 32; r++)
+            {
+                if (used[r])
+                    out << "    int r" << r << " = x[" << r << "];\n";
+            }
+            out << "    int next_pc = " << (last + 1) * 4 << ";\n";
+            for (int i = first; i <= last; i++)
+            {
+                const Instruction &inst = program.instructions[i];
+                switch (inst.kind)
+                {
+                case OP_ADD:
+                    out << "    r" << inst.rd << " = r" << inst.rs1 << " + r" << inst.rs2 << ";\n";
+                    break;
+                case OP_SUB:
+                    out << "    r" << inst.rd << " = r" << inst.rs1 << " - r" << inst.rs2 << ";\n";
+                    break;
+                case OP_SWAP:
+                    out << "    { int t = r" << inst.rs1 << "; r" << inst.rs1 << " = r" << inst.rs2 << "; r" << inst.rs2
+                        << " = t; }\n";
+                    break;
+                case OP_JAL:
+                    out << "    r" << inst.rd << " = " << i * 4 + 4 << ";\n"
+                        << "    next_pc = " << i * 4 + inst.imm + 4 << ";\n";
+                    break;
+                case OP_BNE:
+                    out << "    next_pc = r" << inst.rd << " != r" << inst.rs1 << " ? " << i * 4 + inst.imm << " : "
+                        << i * 4 + 4 << ";\n";
+                    break;
+                default:
+                    break;
+                }
+            }
+            for (int r = 0; r < 32; r++)
+            {
+                if (written[r])
+                    out << "    x[" << r << "] = r" << r << ";\n";
+            }
+            out << "    executed += " << last - first + 1 << ";\n"
+                << "    return next_pc;\n}\n\n";
+        }
+
+        // Runtime: dispatch on the PC until the core leaves the program
+        out << "static void " << prefix << "run_core(int *x, int pc)\n{\n"
+            << "    while (pc >= 0 && pc / 4 < " << size << ")\n    {\n"
+            << "        switch (pc)\n        {\n";
+        for (int b = 0; b < blocks; b++)
+        {
+            out << "        case " << block_start[b] * 4 << ":\n"
+                << "            pc = " << prefix << "block_" << block_start[b] * 4 << "(x);\n"
+                << "            break;\n";
+        }
+        out << "        default:\n"
+            << "            pc = " << prefix << "step_instruction(x, pc);\n"
+            << "            break;\n"
+            << "        }\n    }\n}\n\n";
+        return blocks;
+    }
+
+    // Sorts a partition of memory assigned to a core
+    void bubble_sort_memory(Core &core)
+    {
+        int start_idx = core.core_id * (memory.size() / NUM_CORES);
+        int end_idx = start_idx + (memory.size() / NUM_CORES);
+
+        for (int i = start_idx; i < end_idx - 1; i++)
+        {
+            for (int j = start_idx; j < end_idx - (i - start_idx) - 1; j++)
+            {
+                if (memory[j] > memory[j + 1])
+                {
+                    int larger = memory[j];
+                    memory.store(j, memory[j + 1]);
+                    memory.store(j + 1, larger);
+                }
+            }
+        }
+    }
+
+public:
+    RiscVSimulator(int memory_words = MEMORY_SIZE, bool huge_pages = false)
+        : memory(memory_words, huge_pages),
+                        code_spaces(1),
+                        core_space(NUM_CORES, 0),
+                        entry_pc(NUM_CORES, 0),
+                        block_cache_enabled(true),
+                        block_translations(0),
+                        code_invalidations(0),
+                        jit_enabled(true),
+                        forwarding_enabled(true), // Default: forwarding enabled
+                        precise_pipeline(false),
+                        mode(DETAILED_MODE),
+                        trace_enabled(true),
+                        verbose(true),
+                        cycle_skipping_enabled(true),
+                        fetch_budget(NUM_CORES, -1),
+                        total_cycles(0),
+                        idle_cycle_counted(false),
+                        functional_instructions(0)
+    {
+        for (int i = 0; i < NUM_CORES; i++)
+        {
+            cores.emplace_back(i);
+        }
+        set_program(code_spaces[0], vector<string>());
+        fill(begin(latency_counter), end(latency_counter), 0);
+        fill(begin(core_stalls), end(core_stalls), 0);
+        fill(begin(core_retired), end(core_retired), 0);
+        fill(begin(trace_buffers), end(trace_buffers), nullptr);
+
+        set_default_latencies();
+    }
+
+    // Restores the state right after loading: cores at their entry points,
+    // empty pipelines, zeroed memory and statistics. Programs, translation
+    // caches and configuration are kept and nothing is reallocated; only
+    // the memory pages written since the last reset are cleared. Lets batch
+    // runners reuse one simulator for many short runs.
+    void reset()
+    {
+        reset_architectural_state();
+        total_cycles = 0;
+        idle_cycle_counted = false;
+        fill(begin(core_stalls), end(core_stalls), 0);
+        fill(begin(core_retired), end(core_retired), 0);
+        functional_instructions = 0;
+    }
+
+    // Allows user to set instruction latencies
+    void set_instruction_latency(const string &opcode, int latency)
+    {
+        instruction_latencies[opcode] = latency;
+    }
+
+    // Re-backs simulated RAM with (or without) huge pages, keeping its contents
+    bool use_huge_pages(bool enable)
+    {
+        MemoryBacking backing(memory.size(), enable);
+        backing.copy_from(memory);
+        memory.swap(backing);
+        return memory.huge_pages();
+    }
+
+    // Reports how the simulated RAM is backed on the host
+    void print_memory_backing()
+    {
+        cout << "Memory backing: " << memory.size() << " words ("
+             << memory.size() * sizeof(int) / 1024 << " KB) on " << memory.description() << endl;
+    }
+
+    // Enables or disables data forwarding
+    void enable_forwarding(bool enable)
+    {
+        forwarding_enabled = enable;
+    }
+
+    // Selects the precise pipeline. The original pipeline, kept as the
+    // default so existing results don't change, lets execute() move the
+    // PC after fetch has already moved it past younger instructions, and
+    // lets decode replace an instruction still waiting out its latency, so
+    // it runs a different instruction sequence than the program's. The
+    // precise pipeline stalls decode behind a busy execute stage, leaves
+    // the PC to fetch and resolves BNE/JAL against their own PC, squashing
+    // the younger fetches when they redirect. It then executes exactly the
+    // instructions the functional engines do.
+    void enable_precise_pipeline(bool enable)
+    {
+        precise_pipeline = enable;
+    }
+
+    // Loads assembly instructions from a file
+    bool load_instructions(const string &filename)
+    {
+        vector<string> source = code_spaces[0].program->source;
+        if (!read_program(filename, source))
+            return false;
+
+        set_program(code_spaces[0], source);
+        if (verbose)
+            cout << "Loaded " << source.size() << " instructions from " << filename << "." << endl;
+        return true;
+    }
+
+    // Gives one core its own program, entered at entry, so different cores
+    // can run different programs (sharing memory). Cores given the same
+    // program share its decoded copy and translation caches.
+    bool load_core_program(int core_id, const string &filename, int entry = 0)
+    {
+        if (core_id < 0 || core_id >= NUM_CORES)
+        {
+            cerr << "Error: No core " << core_id << endl;
+            return false;
+        }
+        vector<string> source;
+        if (!read_program(filename, source))
+            return false;
+
+        shared_ptr<const DecodedProgram> decoded = shared_program(source);
+        int space = -1;
+        for (size_t i = 1; i < code_spaces.size(); i++)
+        {
+            if (code_spaces[i].program == decoded)
+                space = i;
+        }
+        if (space < 0)
+        {
+            space = code_spaces.size();
+            code_spaces.emplace_back();
+            set_program(code_spaces[space], source);
+        }
+
+        core_space[core_id] = space;
+        entry_pc[core_id] = entry;
+        cores[core_id].pc = entry;
+        if (verbose)
+            cout << "Loaded " << source.size() << " instructions from " << filename << " for core " << core_id
+                 << " (entry " << entry << ")." << endl;
+        return true;
+    }
+
+    // Executes loaded instructions across all cores (Pipelined)
+    void execute()
+    {
+        run_serial();
+
+        // Print final statistics
+        cout << "\nSimulation completed in " << total_cycles << " cycles." << endl;
+        cout << "Total stalls: " << stall_count() << endl;
+    }
+
+    // Simulates up to cycles clock cycles of the detailed pipeline and
+    // returns how many were simulated (fewer once every core has finished).
+    // Once every core has finished, the statistics include the final idle
+    // cycle exactly as after execute(), counted against the budget like
+    // any other cycle.
+    long long run_cycles(long long cycles)
+    {
+        long long start_cycles = total_cycles;
+        while (total_cycles - start_cycles < cycles && step_cycle(cycles - (total_cycles - start_cycles)))
+        {
+        }
+        if (finished() && total_cycles - start_cycles < cycles)
+            count_idle_cycle();
+        return total_cycles - start_cycles;
+    }
+
+    // Simulates until core_id is about to fetch the instruction at pc, for
+    // at most max_cycles cycles (-1 = no limit). Returns true if pc was
+    // reached, false if the limit was hit or every core finished first.
+    bool run_until_pc(int core_id, int pc, long long max_cycles = -1)
+    {
+        if (core_id < 0 || core_id >= NUM_CORES)
+            return false;
+        Core &core = cores[core_id];
+        long long start_cycles = total_cycles;
+        auto cycles_left = [&]() { return max_cycles < 0 ? LLONG_MAX : max_cycles - (total_cycles - start_cycles); };
+        while (cycles_left() > 0)
+        {
+            if ((core.pc == pc && can_fetch(core)) || !step_cycle(cycles_left()))
+                break;
+        }
+        if (finished() && cycles_left() > 0)
+            count_idle_cycle();
+        return core.pc == pc && can_fetch(core);
+    }
+
+    // True once every core has finished and its pipeline drained
+    bool finished()
+    {
+        for (auto &core : cores)
+        {
+            if (core_active(core))
+                return false;
+        }
+        return true;
+    }
+
+    int register_value(int core_id, int reg) const
+    {
+        if (core_id < 0 || core_id >= NUM_CORES || !is_valid_register(reg))
+            return 0;
+        return cores[core_id].registers[reg];
+    }
+
+    int core_pc(int core_id) const
+    {
+        if (core_id < 0 || core_id >= NUM_CORES)
+            return 0;
+        return cores[core_id].pc;
+    }
+
+    int memory_word(long long address) const
+    {
+        if (address < 0 || (size_t)address >= memory.size())
+            return 0;
+        return memory[address];
+    }
+
+    long long functional_instruction_count() const
+    {
+        return functional_instructions;
+    }
+
+    // Statistics of the detailed pipeline so far
+    SimulationStats statistics() const
+    {
+        SimulationStats stats;
+        stats.loaded = true;
+        stats.cycles = total_cycles;
+        stats.stalls = stall_count();
+        stats.instructions = retired_count();
+        stats.cpi = stats.instructions > 0 ? (double)stats.cycles / stats.instructions : 0.0;
+        for (int i = 0; i < NUM_CORES; i++)
+            memcpy(stats.registers[i], cores[i].registers, sizeof(stats.registers[i]));
+        return stats;
+    }
+
+    // Executes loaded instructions across all cores with the event-driven
+    // engine. Each core is a clocked component ticking in core order within
+    // a cycle, so the results and trace match execute().
+    void execute_event_driven()
+    {
+        events.clear();
+        for (auto &core : cores)
+        {
+            int id = core.core_id;
+            if (core_active(core))
+            {
+                schedule_tick(events, total_cycles + 1, id);
+                idle_cycle_counted = false;
+            }
+        }
+        while (events.run_next())
+        {
+            total_cycles = events.time();
+        }
+        count_idle_cycle();
+
+        cout << "\nSimulation completed in " << total_cycles << " cycles." << endl;
+        cout << "Total stalls: " << stall_count() << endl;
+    }
+
+    // Executes loaded instructions across all cores with the parallel
+    // discrete-event engine (see run_parallel)
+    void execute_parallel(int cores_per_partition = 1, long long lookahead = 1024)
+    {
+        run_parallel(cores_per_partition, lookahead);
+
+        cout << "\nSimulation completed in " << total_cycles << " cycles." << endl;
+        cout << "Total stalls: " << stall_count() << endl;
+    }
+
+    // Verification mode for the functional engines: runs the plain
+    // interpreter, the block cache and the JIT on separate copies of the
+    // simulator, each for up to max_instructions_per_core per core (-1 =
+    // until every core leaves the program), compares the final registers,
+    // PCs, memory and instruction counts against the interpreter, and keeps
+    // the interpreter's result. Runs to completion also check the precise
+    // detailed pipeline, whose registers, PCs and retired instruction count
+    // must match. Returns true if all engines agree.
+    bool verify_functional_engines(long long max_instructions_per_core = -1)
+    {
+        struct Engine
+        {
+            const char *name;
+            bool block_cache, jit;
+        };
+        const Engine engines[] = {{"interpreter", false, false}, {"block cache", true, false}, {"JIT", true, true}};
+
+        vector<RiscVSimulator> runs;
+        vector<long long> executed;
+        for (const Engine &engine : engines)
+        {
+            runs.push_back(*this);
+            RiscVSimulator &run = runs.back();
+            run.block_cache_enabled = engine.block_cache;
+            run.jit_enabled = engine.jit;
+            long long count = 0;
+            for (auto &core : run.cores)
+                count += run.run_core_functional(core, max_instructions_per_core);
+            run.functional_instructions += count;
+            executed.push_back(count);
+        }
+
+        bool passed = true;
+        for (size_t i = 1; i < runs.size(); i++)
+        {
+            vector<string> differences = runs[0].compare_state(runs[i]);
+            if (executed[i] != executed[0])
+                differences.push_back("instructions executed");
+            if (differences.empty())
+                continue;
+            passed = false;
+            cout << "Verification FAILED: " << engines[i].name << " differs from the interpreter in "
+                 << differences.size() << " place(s):" << endl;
+            for (auto &difference : differences)
+                cout << "  " << difference << endl;
+        }
+
+        if (max_instructions_per_core < 0)
+        {
+            RiscVSimulator detailed(*this);
+            detailed.trace_enabled = false;
+            detailed.precise_pipeline = true;
+            long long retired_before = detailed.retired_count();
+            detailed.run_serial();
+            vector<string> differences;
+            for (int i = 0; i < NUM_CORES; i++)
+            {
+                string core = "core " + to_string(i) + " ";
+                for (int r = 0; r < 32; r++)
+                {
+                    if (detailed.cores[i].registers[r] != runs[0].cores[i].registers[r])
+                        differences.push_back(core + "x" + to_string(r));
+                }
+                if (detailed.cores[i].pc != runs[0].cores[i].pc)
+                    differences.push_back(core + "pc");
+            }
+            if (detailed.retired_count() - retired_before != executed[0])
+                differences.push_back("instructions executed");
+            if (!differences.empty())
+            {
+                passed = false;
+                cout << "Verification FAILED: precise pipeline differs from the interpreter in "
+                     << differences.size() << " place(s):" << endl;
+                for (auto &difference : differences)
+                    cout << "  " << difference << endl;
+            }
+        }
+
+        bool block_cache = block_cache_enabled, jit = jit_enabled;
+        *this = runs[0];
+        block_cache_enabled = block_cache;
+        jit_enabled = jit;
+
+        cout << "\nFunctional simulation executed " << executed[0] << " instructions." << endl;
+        if (passed)
+            cout << "Verification passed: block cache, JIT" << (max_instructions_per_core < 0 ? " and precise pipeline" : "")
+                 << " match the interpreter." << endl;
+        return passed;
+    }
+
+    // Verification mode: runs the parallel engine on a copy of the
+    // simulator and the serial execute() loop on another, compares their
+    // final registers, PCs, pipelines, memory and statistics, and keeps the
+    // parallel result. Only the parallel run prints its trace. Returns true
+    // if the two runs match bit for bit.
+    bool verify_parallel(int cores_per_partition = 1, long long lookahead = 1024)
+    {
+        RiscVSimulator serial(*this);
+        serial.trace_enabled = false;
+        serial.run_serial();
+
+        RiscVSimulator parallel(*this);
+        parallel.run_parallel(cores_per_partition, lookahead);
+
+        vector<string> differences = serial.compare_state(parallel);
+        *this = parallel;
+
+        cout << "\nSimulation completed in " << total_cycles << " cycles." << endl;
+        cout << "Total stalls: " << stall_count() << endl;
+        if (differences.empty())
+        {
+            cout << "Verification passed: parallel run matches the serial run." << endl;
+            return true;
+        }
+        cout << "Verification FAILED: " << differences.size() << " difference(s) from the serial run:" << endl;
+        for (auto &difference : differences)
+            cout << "  " << difference << endl;
+        return false;
+    }
+
+    // Enables or disables the per-stage pipeline trace
+    void set_trace(bool enable)
+    {
+        trace_enabled = enable;
+    }
+
+    // Enables or disables progress messages on stdout (on by default)
+    void set_verbose(bool enable)
+    {
+        verbose = enable;
+    }
+
+    // Runs the detailed pipeline until every core has fetched up to
+    // max_instructions_per_core more instructions (-1 = no limit). With
+    // drain the pipeline is emptied afterwards, otherwise the in-flight
+    // instructions are left in the latches. Returns the cycles simulated.
+    long long run_detailed(long long max_instructions_per_core, bool drain = true)
+    {
+        long long start_cycles = total_cycles;
+        for (auto &core : cores)
+        {
+            fetch_budget[core.core_id] = max_instructions_per_core;
+        }
+
+        if (drain)
+        {
+            while (step_cycle())
+            {
+            }
+        }
+        else
+        {
+            while (any_core_can_fetch() && step_cycle())
+            {
+            }
+        }
+
+        for (auto &core : cores)
+        {
+            fetch_budget[core.core_id] = -1;
+        }
+        return total_cycles - start_cycles;
+    }
+
+    // Fast-forwards every core functionally, warms the pipeline up with
+    // warmup_instructions detailed instructions whose timing is discarded,
+    // then measures region_instructions per core of the region of interest.
+    // The reported CPI is aggregate: cycles per instruction retired on any core.
+    // Needs the precise pipeline, the only one that follows the functional
+    // path; returns false if the region can't be run.
+    bool run_region_of_interest(long long fast_forward_instructions, long long region_instructions,
+                                long long warmup_instructions = 0)
+    {
+        if (!mixed_mode_supported("Region-of-interest simulation"))
+            return false;
+
+        long long skipped = 0;
+        for (auto &core : cores)
+        {
+            skipped += run_core_functional(core, fast_forward_instructions);
+        }
+        functional_instructions += skipped;
+
+        if (warmup_instructions > 0)
+        {
+            run_detailed(warmup_instructions, false);
+        }
+
+        long long start_cycles = total_cycles;
+        int start_stalls = stall_count();
+        long long start_retired = retired_count();
+
+        run_detailed(region_instructions);
+
+        long long cycles = total_cycles - start_cycles;
+        long long retired = retired_count() - start_retired;
+        cout << "\nFast-forwarded " << skipped << " instructions functionally." << endl;
+        cout << "Region of interest: " << retired << " instructions in " << cycles << " cycles";
+        if (retired > 0)
+        {
+            cout << " (CPI " << fixed << setprecision(3) << (double)cycles / retired << ")";
+            cout.unsetf(ios::fixed);
+            cout << setprecision(6);
+        }
+        cout << endl;
+        cout << "Region stalls: " << stall_count() - start_stalls << endl;
+        return true;
+    }
+
+    // Verification mode for the region of interest: runs it on a copy of
+    // the simulator and the same number of instructions per core purely in
+    // detail on another, compares the final registers and PCs, and keeps
+    // the region-of-interest result. Returns true if the two runs agree.
+    bool verify_region_of_interest(long long fast_forward_instructions, long long region_instructions,
+                                   long long warmup_instructions = 0)
+    {
+        RiscVSimulator detailed(*this);
+        detailed.trace_enabled = false;
+        RiscVSimulator region(*this);
+        if (!region.run_region_of_interest(fast_forward_instructions, region_instructions, warmup_instructions))
+            return false;
+        detailed.run_detailed(fast_forward_instructions + warmup_instructions + region_instructions);
+        *this = region;
+
+        vector<string> differences;
+        for (int i = 0; i < NUM_CORES; i++)
+        {
+            string core = "core " + to_string(i) + " ";
+            for (int r = 0; r < 32; r++)
+            {
+                if (detailed.cores[i].registers[r] != cores[i].registers[r])
+                    differences.push_back(core + "x" + to_string(r));
+            }
+            if (detailed.cores[i].pc != cores[i].pc)
+                differences.push_back(core + "pc");
+        }
+        if (differences.empty())
+        {
+            cout << "Verification passed: region of interest matches the detailed run." << endl;
+            return true;
+        }
+        cout << "Verification FAILED: " << differences.size() << " difference(s) from the detailed run:" << endl;
+        for (auto &difference : differences)
+            cout << "  " << difference << endl;
+        return false;
+    }
+
+    // Mixed functional/detailed runs are only meaningful when both engines
+    // run the same instruction sequence, which the original pipeline does
+    // not; reports why run is refused otherwise
+    bool mixed_mode_supported(const string &run) const
+    {
+        if (precise_pipeline)
+            return true;
+        cerr << "Error: " << run << " needs the precise pipeline (--precise-pipeline on): the original "
+             << "pipeline does not follow the path of the functional engine" << endl;
+        return false;
+    }
+
+    // Two-sided 95% quantile of Student's t distribution
+    static double student_t95(long long degrees_of_freedom)
+    {
+        static const double table[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                       2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                       2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+        if (degrees_of_freedom <= 30)
+            return table[max(1LL, degrees_of_freedom) - 1];
+        return 1.960 + 2.4 / degrees_of_freedom; // Within 0.002 of the exact value
+    }
+
+    // SMARTS-style systematic sampling: every sampling_period instructions
+    // per core, warm the pipeline up for warmup_instructions and measure a
+    // detailed window of window_instructions; the rest is fast-forwarded
+    // functionally. Reports the CPI estimate with a 95% confidence interval
+    // (Student's t; undefined with fewer than two windows) and returns the
+    // mean CPI, or 0 if the program can't be sampled.
+    double run_sampled(long long sampling_period, long long window_instructions, long long warmup_instructions = 0)
+    {
+        if (!mixed_mode_supported("Sampled simulation"))
+            return 0.0;
+
+        long long fast_forward = sampling_period - window_instructions - warmup_instructions;
+        if (fast_forward < 0)
+            fast_forward = 0;
+
+        vector<double> samples;
+        long long window_cycles = 0;
+        long long window_retired = 0;
+        long long start_functional = functional_instructions;
+        long long start_retired = retired_count();
+
+        while (any_core_in_program())
+        {
+            for (auto &core : cores)
+            {
+                functional_instructions += run_core_functional(core, fast_forward);
+            }
+            if (!any_core_in_program())
+                break;
+
+            if (warmup_instructions > 0)
+            {
+                run_detailed(warmup_instructions, false);
+            }
+
+            long long retired_before = retired_count();
+            long long cycles = run_detailed(window_instructions);
+            long long retired = retired_count() - retired_before;
+            if (retired > 0)
+            {
+                samples.push_back((double)cycles / retired);
+                window_cycles += cycles;
+                window_retired += retired;
+            }
+        }
+
+        long long total_instructions = (functional_instructions - start_functional) +
+                                       (retired_count() - start_retired);
+        double mean = 0.0;
+        for (double cpi : samples)
+        {
+            mean += cpi;
+        }
+        if (!samples.empty())
+            mean /= samples.size();
+
+        double variance = 0.0;
+        for (double cpi : samples)
+        {
+            variance += (cpi - mean) * (cpi - mean);
+        }
+        if (samples.size() > 1)
+            variance /= samples.size() - 1;
+
+        cout << "\nSampled simulation: " << samples.size() << " detailed windows, "
+             << window_retired << " of " << total_instructions << " instructions simulated in detail." << endl;
+        cout << fixed << setprecision(3);
+        cout << "Estimated CPI: " << mean;
+        if (samples.size() > 1)
+        {
+            double half_width = student_t95(samples.size() - 1) * sqrt(variance / samples.size());
+            cout << " +/- " << half_width << " (95% confidence)";
+            if (mean > 0.0)
+                cout << ", relative error " << 100.0 * half_width / mean << "%";
+        }
+        else
+            cout << " (confidence interval undefined with fewer than 2 windows)";
+        cout << endl;
+        cout << "Estimated cycles for the full run: " << (long long)(mean * total_instructions) << endl;
+        cout.unsetf(ios::fixed);
+        cout << setprecision(6);
+        return mean;
+    }
+
+    // Profiles the program functionally, recording a basic-block vector for
+    // every interval_size instructions per core, clusters the vectors and
+    // returns one representative interval per cluster with its weight. The
+    // number of clusters is the smallest k up to max_k whose BIC reaches 90%
+    // of the best score, as SimPoint does. Leaves the simulator reset.
+    vector<SimPoint> profile_simpoints(long long interval_size, int max_k = 10)
+    {
+        // Blocks of every code space get their own vector dimensions
+        vector<int> block_base(code_spaces.size());
+        int blocks = 0;
+        for (size_t i = 0; i < code_spaces.size(); i++)
+        {
+            block_base[i] = blocks;
+            blocks += find_basic_blocks(code_spaces[i]);
+        }
+        reset_architectural_state();
+
+        // One basic-block vector per interval, summed over all cores
+        vector<vector<double>> vectors;
+        vector<long long> counts(blocks);
+        while (any_core_in_program())
+        {
+            fill(counts.begin(), counts.end(), 0);
+            long long executed = 0;
+            for (auto &core : cores)
+            {
+                long long *space_counts = counts.data() + block_base[core_space[core.core_id]];
+                executed += run_core_functional(core, interval_size, space_counts);
+            }
+            if (executed == 0)
+                break;
+
+            // Normalise so intervals are compared by their block mix
+            vector<double> bbv(blocks);
+            for (int b = 0; b < blocks; b++)
+            {
+                bbv[b] = (double)counts[b] / executed;
+            }
+            vectors.push_back(bbv);
+        }
+        reset_architectural_state();
+
+        vector<SimPoint> points;
+        if (vectors.empty())
+            return points;
+
+        mt19937 rng(42); // Fixed seed keeps the selection reproducible
+        int k_limit = min<int>(max_k, vectors.size());
+        vector<vector<int>> assignments(k_limit + 1);
+        vector<vector<vector<double>>> centroids(k_limit + 1);
+        vector<double> scores(k_limit + 1);
+        for (int k = 1; k <= k_limit; k++)
+        {
+            scores[k] = kmeans(vectors, k, rng, assignments[k], centroids[k]);
+        }
+        double best = *max_element(scores.begin() + 1, scores.end());
+        double worst = *min_element(scores.begin() + 1, scores.end());
+        int chosen = k_limit;
+        for (int k = 1; k <= k_limit; k++)
+        {
+            if (scores[k] >= worst + 0.9 * (best - worst))
+            {
+                chosen = k;
+                break;
+            }
+        }
+
+        // The interval closest to each centroid represents its cluster
+        for (int c = 0; c < chosen; c++)
+        {
+            int members = 0;
+            int representative = -1;
+            for (size_t i = 0; i < vectors.size(); i++)
+            {
+                if (assignments[chosen][i] != c)
+                    continue;
+                members++;
+                if (representative < 0 ||
+                    distance2(vectors[i], centroids[chosen][c]) < distance2(vectors[representative], centroids[chosen][c]))
+                    representative = i;
+            }
+            if (members > 0)
+                points.push_back(SimPoint(representative, (double)members / vectors.size()));
+        }
+
+        cout << "\nProfiled " << vectors.size() << " intervals of " << interval_size << " instructions over "
+             << blocks << " basic blocks; selected " << points.size() << " simulation points." << endl;
+        for (auto &point : points)
+        {
+            cout << "SimPoint interval " << point.interval << " weight " << point.weight << endl;
+        }
+        return points;
+    }
+
+    // Writes simulation points as "interval weight" lines
+    void save_simpoints(const string &filename, const vector<SimPoint> &points)
+    {
+        ofstream file(filename);
+        if (!file.is_open())
+        {
+            cerr << "Error: Cannot open " << filename << endl;
+            return;
+        }
+        for (auto &point : points)
+        {
+            file << point.interval << " " << point.weight << endl;
+        }
+    }
+
+    // Reads simulation points written by save_simpoints()
+    vector<SimPoint> load_simpoints(const string &filename)
+    {
+        vector<SimPoint> points;
+        ifstream file(filename);
+        if (!file.is_open())
+        {
+            cerr << "Error: Cannot open " << filename << endl;
+            return points;
+        }
+        SimPoint point;
+        while (file >> point.interval >> point.weight)
+        {
+            points.push_back(point);
+        }
+        return points;
+    }
+
+    // Simulates each point in detail (fast-forwarding to it from the start)
+    // and combines the per-point CPIs into a weighted whole-program estimate.
+    // Returns 0 unless the precise pipeline is on, as the original one does
+    // not reach the profiled intervals.
+    double run_simpoints(const vector<SimPoint> &points, long long interval_size, long long warmup_instructions = 0)
+    {
+        if (!mixed_mode_supported("SimPoint simulation"))
+            return 0.0;
+
+        double weighted_cpi = 0.0;
+        double total_weight = 0.0;
+        for (auto &point : points)
+        {
+            reset_architectural_state();
+            long long start = point.interval * interval_size;
+            for (auto &core : cores)
+            {
+                functional_instructions += run_core_functional(core, max(0LL, start - warmup_instructions));
+            }
+            if (warmup_instructions > 0)
+            {
+                run_detailed(min(start, warmup_instructions), false);
+            }
+
+            long long retired_before = retired_count();
+            long long cycles = run_detailed(interval_size);
+            long long retired = retired_count() - retired_before;
+            if (retired == 0)
+                continue;
+
+            double cpi = (double)cycles / retired;
+            weighted_cpi += point.weight * cpi;
+            total_weight += point.weight;
+            cout << "SimPoint interval " << point.interval << ": CPI " << cpi << " (weight " << point.weight << ")" << endl;
+        }
+        reset_architectural_state();
+
+        if (total_weight > 0.0)
+            weighted_cpi /= total_weight;
+        cout << "Weighted whole-program CPI estimate: " << weighted_cpi << endl;
+        return weighted_cpi;
+    }
+
+    // Writes the complete simulator state to a binary checkpoint: programs
+    // (including stores into code), cores, pipeline latches, configuration,
+    // statistics and memory. Zero pages are stored as a marker only. An
+    // incremental checkpoint stores only the memory pages written since the
+    // previous checkpoint saved or loaded, and refers to that file for the
+    // rest, so it must be kept. A full checkpoint is written instead when
+    // filename is part of that chain, or the chain is as long as a restore
+    // may follow. Translation caches are not saved; they are rebuilt on
+    // demand after a restore.
+    bool save_checkpoint(const string &filename, bool incremental = false)
+    {
+        bool in_chain = find(checkpoint_chain.begin(), checkpoint_chain.end(), filename) != checkpoint_chain.end();
+        string parent = incremental && !checkpoint_chain.empty() && !in_chain &&
+                                checkpoint_chain.size() < MAX_CHECKPOINT_CHAIN
+                            ? checkpoint_chain.front()
+                            : "";
+        ofstream out(filename, ios::binary);
+        if (!out.is_open())
+        {
+            cerr << "Error: Cannot open " << filename << endl;
+            return false;
+        }
+        out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+        write_pod(out, (int32_t)NUM_CORES);
+        write_string(out, parent);
+
+        write_pod(out, (uint64_t)memory.size());
+        for (size_t page = 0; page < memory.pages(); page++)
+        {
+            const int *words = memory.page_words(page);
+            size_t count = memory.page_size(page);
+            if (!parent.empty() && !memory.page_dirty(page))
+            {
+                write_pod(out, (uint8_t)PAGE_PARENT);
+            }
+            else if (all_of(words, words + count, [](int word) { return word == 0; }))
+            {
+                write_pod(out, (uint8_t)PAGE_ZERO);
+            }
+            else
+            {
+                write_pod(out, (uint8_t)PAGE_DATA);
+                out.write(reinterpret_cast<const char *>(words), count * sizeof(int));
+            }
+        }
+
+        write_pod(out, (uint32_t)code_spaces.size());
+        for (auto &space : code_spaces)
+        {
+            write_pod(out, (uint32_t)space.program->source.size());
+            for (auto &line : space.program->source)
+                write_string(out, line);
+        }
+
+        for (int i = 0; i < NUM_CORES; i++)
+        {
+            write_pod(out, cores[i].registers);
+            write_pod(out, cores[i].pc);
+            write_pod(out, cores[i].stalled);
+            write_pod(out, (int32_t)core_space[i]);
+            write_pod(out, (int32_t)entry_pc[i]);
+            write_pod(out, fetch_budget[i]);
+        }
+        write_latch(out, fetch_stage);
+        write_latch(out, decode_stage);
+        write_latch(out, execute_stage);
+        write_latch(out, memory_stage);
+        write_latch(out, writeback_stage);
+        write_pod(out, latency_counter);
+
+        write_pod(out, (uint32_t)instruction_latencies.size());
+        for (auto &latency : instruction_latencies)
+        {
+            write_string(out, latency.first);
+            write_pod(out, (int32_t)latency.second);
+        }
+        write_pod(out, forwarding_enabled);
+        write_pod(out, precise_pipeline);
+        write_pod(out, (int32_t)mode);
+        write_pod(out, trace_enabled);
+        write_pod(out, cycle_skipping_enabled);
+        write_pod(out, block_cache_enabled);
+        write_pod(out, jit_enabled);
+
+        write_pod(out, total_cycles);
+        write_pod(out, idle_cycle_counted);
+        write_pod(out, core_stalls);
+        write_pod(out, core_retired);
+        write_pod(out, functional_instructions);
+        write_pod(out, block_translations);
+        write_pod(out, code_invalidations);
+        if (!out)
+            return false;
+
+        memory.clear_dirty();
+        if (parent.empty())
+            checkpoint_chain.clear();
+        checkpoint_chain.insert(checkpoint_chain.begin(), filename);
+        return true;
+    }
+
+    // Restores the state written by save_checkpoint(). The trace, verbose
+    // and simulation mode settings stay as they are. On error the simulator
+    // is left unchanged.
+    bool load_checkpoint(const string &filename)
+    {
+        ifstream in(filename, ios::binary);
+        if (!in.is_open())
+        {
+            cerr << "Error: Cannot open " << filename << endl;
+            return false;
+        }
+        RiscVSimulator restored(0);
+        if (!read_checkpoint_memory(filename, in, restored.memory, memory.huge_pages(), restored.checkpoint_chain))
+            return false;
+
+        bool ok = true;
+        uint32_t space_count = 0;
+        ok = ok && read_pod(in, space_count) && space_count > 0 && space_count <= bytes_left(in) / sizeof(uint32_t);
+        restored.code_spaces.resize(ok ? space_count : 1);
+        for (uint32_t s = 0; ok && s < space_count; s++)
+        {
+            uint32_t lines = 0;
+            ok = read_pod(in, lines) && lines <= bytes_left(in) / sizeof(uint32_t);
+            vector<string> source(ok ? lines : 0);
+            for (auto &line : source)
+                ok = ok && read_string(in, line);
+            if (ok)
+                restored.set_program(restored.code_spaces[s], source);
+        }
+
+        for (int i = 0; ok && i < NUM_CORES; i++)
+        {
+            int32_t space = 0, entry = 0;
+            ok = read_pod(in, restored.cores[i].registers) && read_pod(in, restored.cores[i].pc) &&
+                 read_pod(in, restored.cores[i].stalled) && read_pod(in, space) && read_pod(in, entry) &&
+                 read_pod(in, restored.fetch_budget[i]) && space >= 0 && (uint32_t)space < space_count &&
+                 restored.cores[i].pc >= 0 && entry >= 0;
+            restored.core_space[i] = space;
+            restored.entry_pc[i] = entry;
+        }
+        ok = ok && read_latch(in, restored.fetch_stage) && read_latch(in, restored.decode_stage) &&
+             read_latch(in, restored.execute_stage) && read_latch(in, restored.memory_stage) &&
+             read_latch(in, restored.writeback_stage) && read_pod(in, restored.latency_counter);
+        // Checkpoints hold the current programs only, so in-flight
+        // instructions refer to them and must lie inside them
+        for (PipelineLatch *stage : {&restored.fetch_stage, &restored.decode_stage, &restored.execute_stage,
+                                     &restored.memory_stage, &restored.writeback_stage})
+        {
+            for (int i = 0; ok && i < NUM_CORES; i++)
+            {
+                const CodeSpace &space = restored.code_spaces[restored.core_space[i]];
+                ok = !stage->valid[i] || (stage->pc[i] >= 0 && stage->pc[i] / 4 < space.size());
+                stage->space[i] = restored.core_space[i];
+                stage->version[i] = space.versions.size() - 1;
+            }
+        }
+        for (int i = 0; ok && i < NUM_CORES; i++)
+            ok = restored.latency_counter[i] >= 0;
+
+        uint32_t latency_count = 0;
+        ok = ok && read_pod(in, latency_count) &&
+             latency_count <= bytes_left(in) / (sizeof(uint32_t) + sizeof(int32_t));
+        restored.instruction_latencies.clear();
+        for (uint32_t i = 0; ok && i < latency_count; i++)
+        {
+            string opcode;
+            int32_t latency = 0;
+            ok = read_string(in, opcode) && read_pod(in, latency);
+            restored.instruction_latencies[opcode] = latency;
+        }
+        int32_t saved_mode = 0;
+        bool saved_trace = false;
+        ok = ok && read_pod(in, restored.forwarding_enabled) && read_pod(in, restored.precise_pipeline) &&
+             read_pod(in, saved_mode) &&
+             read_pod(in, saved_trace) && read_pod(in, restored.cycle_skipping_enabled) &&
+             read_pod(in, restored.block_cache_enabled) && read_pod(in, restored.jit_enabled);
+        ok = ok && saved_mode >= DETAILED_MODE && saved_mode <= VERIFY_FUNCTIONAL_MODE;
+
+        ok = ok && read_pod(in, restored.total_cycles) && read_pod(in, restored.idle_cycle_counted) &&
+             read_pod(in, restored.core_stalls) &&
+             read_pod(in, restored.core_retired) && read_pod(in, restored.functional_instructions) &&
+             read_pod(in, restored.block_translations) && read_pod(in, restored.code_invalidations);
+        if (!ok)
+        {
+            cerr << "Error: " << filename << " is truncated or corrupt" << endl;
+            return false;
+        }
+
+        restored.memory.clear_dirty();
+        // Output and the engine that runs next are host settings, not part
+        // of the state: a library handle stays silent after loading a
+        // checkpoint saved with tracing on
+        restored.verbose = verbose;
+        restored.trace_enabled = trace_enabled;
+        restored.mode = mode;
+        *this = restored;
+        return true;
+    }
+
+    // Turns event-driven skipping of latency-only cycles on or off
+    void enable_cycle_skipping(bool enable)
+    {
+        cycle_skipping_enabled = enable;
+    }
+
+    // Turns the functional engine's basic-block translation cache on or off
+    void enable_block_cache(bool enable)
+    {
+        block_cache_enabled = enable;
+    }
+
+    // Ahead-of-time translation: writes the loaded programs as a standalone
+    // C++ program with one function per basic block (registers held in
+    // locals inside each block) and a small runtime that runs every core
+    // from its entry point and prints the registers like print_registers().
+    // Jumps that don't land on a block start go through a per-instruction
+    // fallback.
+    bool translate_to_cpp(const string &filename)
+    {
+        ofstream out(filename);
+        if (!out.is_open())
+        {
+            cerr << "Error: Cannot open " << filename << endl;
+            return false;
+        }
+
+        out << "// Generated by RiscVSimulator::translate_to_cpp - do not edit.\n"
+            << "#include <iostream>\n"
+            << "using namespace std;\n\n"
+            << "static const int NUM_CORES = " << NUM_CORES << ";\n"
+            << "static long long executed = 0;\n\n";
+
+        int instructions = 0;
+        int blocks = 0;
+        for (size_t i = 0; i < code_spaces.size(); i++)
+        {
+            blocks += emit_cpp_program(out, code_spaces[i], "p" + to_string(i) + "_");
+            instructions += code_spaces[i].size();
+        }
+
+        out << "int main()\n{\n";
+        for (int core_id = 0; core_id < NUM_CORES; core_id++)
+        {
+            out << "    {\n"
+                << "        int x[32] = {0};\n"
+                << "        x[3] = " << core_id << ";\n"
+                << "        p" << core_space[core_id] << "_run_core(x, " << entry_pc[core_id] << ");\n"
+                << "        cout << \"Core " << core_id << " Registers:\" << endl;\n"
+                << "        for (int i = 0; i < 32; i++)\n"
+                << "            cout << \"x\" << i << \": \" << x[i] << endl;\n"
+                << "        cout << endl;\n"
+                << "    }\n";
+        }
+        out << "    cerr << \"Executed \" << executed << \" instructions.\" << endl;\n"
+            << "    return 0;\n}\n";
+
+        if (verbose)
+            cout << "Translated " << instructions << " instructions in " << blocks << " basic blocks to " << filename << "." << endl;
+        return out.good();
+    }
+
+    // Turns translation of hot blocks to native x86-64 code on or off. Hosts
+    // without JIT support keep using the block interpreter.
+    void enable_jit(bool enable)
+    {
+        jit_enabled = enable;
+    }
+
+    // True if the instruction at index of space's private program copy can
+    // be replaced in place: no other simulator shares the copy, and no
+    // valid latch holds that instruction of it
+    bool private_program_writable(const CodeSpace &space, int index) const
+    {
+        if (!space.modified || space.program != space.modified)
+            return false;
+        int space_index = &space - code_spaces.data();
+        int current = space.versions.size() - 1;
+        for (const PipelineLatch *stage : {&fetch_stage, &decode_stage, &execute_stage, &memory_stage, &writeback_stage})
+        {
+            for (int i = 0; i < NUM_CORES; i++)
+            {
+                if (stage->valid[i] && stage->space[i] == space_index && stage->version[i] == current &&
+                    stage->pc[i] / 4 == index)
+                    return false;
+            }
+        }
+        // Referenced by program, modified and the newest version only
+        return space.modified.use_count() == 3;
+    }
+
+    // Overwrites the instruction at pc in the program core_id runs (a store
+    // into the code) and drops any predecoded or translated copies of it
+    void store_instruction(int pc, const string &text, int core_id = 0)
+    {
+        CodeSpace &space = space_of(cores[core_id]);
+        if (pc < 0 || pc / 4 >= space.size())
+        {
+            cerr << "Error: No instruction at address " << pc << endl;
+            return;
+        }
+
+        // The first store gives the space a private copy of the shared
+        // program. Later stores modify that copy in place unless another
+        // simulator holds it too or an in-flight instruction was fetched
+        // from the word being replaced.
+        int index = pc / 4;
+        if (!private_program_writable(space, index))
+        {
+            space.modified = make_shared<DecodedProgram>(*space.program);
+            space.program = space.modified;
+            add_program_version(space);
+        }
+        space.modified->source[index] = text;
+        space.modified->instructions[index] = decode_line(text, -1, index * 4);
+        code_page_written(space, index);
+    }
+
+    // Reports the functional engine's translation caches
+    void print_code_cache_stats()
+    {
+        int dirty_pages = 0;
+        int code_pages = 0;
+        size_t native_blocks = 0;
+        for (auto &space : code_spaces)
+        {
+            dirty_pages += count(space.code_page_dirty.begin(), space.code_page_dirty.end(), true);
+            code_pages += space.code_page_dirty.size();
+            native_blocks += space.jit.compiled_blocks();
+        }
+        cout << "Blocks translated: " << block_translations << endl;
+        cout << "Blocks compiled to native code: " << native_blocks << endl;
+        cout << "Code pages written: " << dirty_pages << " of " << code_pages << endl;
+        cout << "Blocks invalidated by code stores: " << code_invalidations << endl;
+    }
+
+    // Selects the engine used by run()
+    void set_simulation_mode(SimulationMode new_mode)
+    {
+        mode = new_mode;
+    }
+
+    // Runs the loaded program with the selected engine
+    void run()
+    {
+        if (mode == FUNCTIONAL_MODE)
+            execute_functional();
+        else if (mode == LOCKSTEP_MODE)
+            execute_lockstep();
+        else if (mode == EVENT_MODE)
+            execute_event_driven();
+        else if (mode == PARALLEL_MODE)
+            execute_parallel();
+        else if (mode == VERIFY_MODE)
+            verify_parallel();
+        else if (mode == VERIFY_FUNCTIONAL_MODE)
+            verify_functional_engines();
+        else
+            execute();
+    }
+
+    // Executes the predecoded program on every core without modelling the
+    // pipeline. Returns the number of instructions executed.
+    long long execute_functional(long long max_instructions_per_core = -1)
+    {
+        long long executed = 0;
+        for (auto &core : cores)
+        {
+            executed += run_core_functional(core, max_instructions_per_core);
+        }
+        functional_instructions += executed;
+
+        if (verbose)
+            cout << "\nFunctional simulation executed " << executed << " instructions." << endl;
+        return executed;
+    }
+
+    // Runs independent simulations on a work-stealing pool of host threads
+    // (threads = 0 sizes it to the host) and returns one statistics record
+    // per job, in job order. Each program file is read and decoded once and
+    // the decoded program is shared by every job using it. Jobs run
+    // silently, without trace.
+    static vector<SimulationStats> run_batch(const vector<SimulationJob> &jobs, int threads = 0)
+    {
+        map<string, shared_ptr<const DecodedProgram>> programs;
+        for (auto &job : jobs)
+        {
+            if (programs.count(job.program_file))
+                continue;
+            vector<string> source;
+            programs[job.program_file] = read_program(job.program_file, source) ? shared_program(source) : nullptr;
+        }
+
+        vector<SimulationStats> results(jobs.size());
+        vector<function<void()>> tasks;
+        for (size_t i = 0; i < jobs.size(); i++)
+        {
+            shared_ptr<const DecodedProgram> program = programs[jobs[i].program_file];
+            if (!program)
+                continue;
+            tasks.push_back([&jobs, &results, program, i]()
+                            { results[i] = run_job(jobs[i], program); });
+        }
+        WorkStealingPool(threads).run(move(tasks));
+        // The pool's own threads are gone; the calling thread ran jobs too
+        // and must not keep its simulator's memory and program alive
+        batch_simulator().reset();
+        return results;
+    }
+
+    // Design-space exploration: simulates the cartesian product of the
+    // sweep's parameter ranges, or a random subset of samples points of it
+    // (samples = 0 for all), on the batch pool. Results are memoized by a
+    // hash of program and configuration, in memory and, if cache_file is
+    // given, on disk, so re-running a sweep only simulates new points.
+    static vector<SweepResult> run_sweep(const SweepSpace &space, size_t samples = 0, unsigned seed = 1,
+                                         const string &cache_file = "", int threads = 0)
+    {
+        vector<SweepResult> results;
+        vector<string> source;
+        if (!read_program(space.program_file, source))
+            return results;
+
+        // Enumerate the points as mixed-radix numbers over the ranges
+        vector<pair<string, vector<int>>> latency_ranges;
+        for (auto &range : space.latencies)
+        {
+            if (!range.second.empty())
+                latency_ranges.push_back(range);
+        }
+        size_t total = max<size_t>(space.forwarding.size(), 1);
+        for (auto &range : latency_ranges)
+            total *= range.second.size();
+
+        vector<size_t> indices;
+        if (samples == 0 || samples >= total)
+        {
+            for (size_t i = 0; i < total; i++)
+                indices.push_back(i);
+        }
+        else
+        {
+            // Floyd's algorithm: samples distinct points without listing all of them
+            mt19937_64 rng(seed);
+            set<size_t> chosen;
+            for (size_t j = total - samples; j < total; j++)
+            {
+                size_t t = uniform_int_distribution<size_t>(0, j)(rng);
+                chosen.insert(chosen.count(t) ? j : t);
+            }
+            indices.assign(chosen.begin(), chosen.end());
+        }
+
+        for (size_t index : indices)
+        {
+            SweepResult point;
+            point.job = SimulationJob(space.program_file);
+            point.job.max_instructions = space.max_instructions;
+            for (auto &range : latency_ranges)
+            {
+                point.job.latencies[range.first] = range.second[index % range.second.size()];
+                index /= range.second.size();
+            }
+            if (!space.forwarding.empty())
+                point.job.forwarding = space.forwarding[index % space.forwarding.size()];
+            point.cached = false;
+            results.push_back(point);
+        }
+
+        // Look the points up in the cache and simulate the rest. The lock
+        // covers only the cache, so concurrent sweeps simulate in parallel.
+        static mutex cache_mutex;
+        static map<uint64_t, SimulationStats> cache;
+        vector<uint64_t> keys;
+        vector<SimulationJob> jobs;
+        vector<size_t> job_points;
+        {
+            lock_guard<mutex> lock(cache_mutex);
+            if (!cache_file.empty())
+                load_sweep_cache(cache_file, cache);
+            for (size_t i = 0; i < results.size(); i++)
+            {
+                keys.push_back(sweep_key(source, results[i].job));
+                auto it = cache.find(keys[i]);
+                if (it != cache.end())
+                {
+                    results[i].stats = it->second;
+                    results[i].cached = true;
+                }
+                else
+                {
+                    jobs.push_back(results[i].job);
+                    job_points.push_back(i);
+                }
+            }
+        }
+
+        vector<SimulationStats> simulated = run_batch(jobs, threads);
+
+        lock_guard<mutex> lock(cache_mutex);
+        ofstream out;
+        if (!cache_file.empty())
+            out.open(cache_file, ios::app);
+        for (size_t j = 0; j < simulated.size(); j++)
+        {
+            size_t i = job_points[j];
+            results[i].stats = simulated[j];
+            cache[keys[i]] = simulated[j];
+            if (out.is_open())
+                save_sweep_result(out, keys[i], simulated[j]);
+        }
+
+        cout << "Sweep of " << space.program_file << ": " << results.size() << " of " << total << " points, "
+             << jobs.size() << " simulated, " << results.size() - jobs.size() << " from cache." << endl;
+        return results;
+    }
+
+    // Prints one line per sweep point: its configuration and results
+    static void print_sweep(const vector<SweepResult> &results)
+    {
+        for (auto &result : results)
+        {
+            for (auto &latency : result.job.latencies)
+                cout << latency.first << "=" << latency.second << " ";
+            cout << "forwarding=" << (result.job.forwarding ? "on" : "off")
+                 << ": " << result.stats.cycles << " cycles, CPI " << result.stats.cpi
+                 << (result.cached ? " (cached)" : "") << endl;
+        }
+    }
+
+    // What-if runs from the current (e.g. warmed-up) state: each variant
+    // callback reconfigures its own copy of the simulator, which then runs
+    // the detailed pipeline to completion, or for max_instructions more
+    // instructions per core, without trace. On POSIX hosts every variant is
+    // a forked child sharing this simulator's memory copy-on-write, so only
+    // the pages it writes are copied. At most one child per hardware thread
+    // runs at a time, and each is joined as soon as it finishes. Forking is
+    // only safe while no other thread runs in the process: on Linux a
+    // multithreaded host is detected and every variant takes the fallback,
+    // elsewhere it must not call this while other threads run. Elsewhere,
+    // or if fork() fails, the variant runs on a deep copy on the batch pool.
+    // This simulator is left unchanged. Returns one statistics record per
+    // variant, in order; cycle and instruction counts include the work done
+    // before the fork.
+    vector<SimulationStats> fork_what_if(const vector<function<void(RiscVSimulator &)>> &variants,
+                                         long long max_instructions_per_core = -1)
+    {
+        vector<SimulationStats> results(variants.size());
+        vector<bool> joined(variants.size(), false);
+        size_t max_children = other_threads_running() ? 0 : max(1u, thread::hardware_concurrency());
+        vector<int> pipes, children;
+        vector<size_t> running; // Variant of each live child
+        size_t next = 0;
+        while (max_children > 0 && (next < variants.size() || !running.empty()))
+        {
+            while (next < variants.size() && running.size() < max_children)
+            {
+                int child = 0;
+                int fd = fork_variant(variants[next], max_instructions_per_core, child);
+                if (fd >= 0)
+                {
+                    pipes.push_back(fd);
+                    children.push_back(child);
+                    running.push_back(next);
+                }
+                next++;
+            }
+            if (running.empty())
+                continue;
+
+            size_t k = next_finished_variant(pipes);
+            joined[running[k]] = join_variant(pipes[k], children[k], results[running[k]]);
+            pipes.erase(pipes.begin() + k);
+            children.erase(children.begin() + k);
+            running.erase(running.begin() + k);
+        }
+
+        vector<function<void()>> fallback;
+        for (size_t i = 0; i < variants.size(); i++)
+        {
+            if (joined[i])
+                continue;
+            fallback.push_back([this, &variants, &results, i, max_instructions_per_core]()
+                               {
+                                   RiscVSimulator copy(*this);
+                                   copy.trace_enabled = false;
+                                   variants[i](copy);
+                                   results[i] = copy.run_to_stats(max_instructions_per_core);
+                               });
+        }
+        WorkStealingPool().run(move(fallback));
+        return results;
+    }
+
+    // SPMD lockstep execution: the cores are lanes of a transposed register
+    // file. Each step runs the instruction at the lowest active PC for every
+    // core sharing that PC, using host SIMD for the register operations.
+    // Cores whose control flow diverged run in smaller groups (scalar when
+    // alone) and rejoin once their PCs meet again. Same results as
+    // execute_functional(). Returns the number of instructions executed.
+    long long execute_lockstep(long long max_instructions_per_core = -1)
+    {
+        int lanes[32][NUM_CORES];
+        int pc[NUM_CORES];
+        long long executed[NUM_CORES];
+        int mask[NUM_CORES];
+        for (int lane = 0; lane < NUM_CORES; lane++)
+        {
+            for (int r = 0; r < 32; r++)
+            {
+                lanes[r][lane] = cores[lane].registers[r];
+            }
+            pc[lane] = cores[lane].pc;
+            executed[lane] = 0;
+        }
+
+        int lane_size[NUM_CORES]; // Size of the program each lane runs
+        for (int lane = 0; lane < NUM_CORES; lane++)
+        {
+            lane_size[lane] = code_spaces[core_space[lane]].size();
+        }
+
+        long long vector_steps = 0;
+        long long scalar_steps = 0;
+        while (true)
+        {
+            // Group the active lanes at the lowest PC; only lanes running
+            // the same program (code space) can share a group
+            int group_space = -1;
+            int group_pc = INT_MAX;
+            for (int lane = 0; lane < NUM_CORES; lane++)
+            {
+                if (executed[lane] == max_instructions_per_core || pc[lane] < 0 || pc[lane] / 4 >= lane_size[lane])
+                    continue;
+                int space = core_space[lane];
+                if (group_space < 0 || space < group_space || (space == group_space && pc[lane] < group_pc))
+                {
+                    group_space = space;
+                    group_pc = pc[lane];
+                }
+            }
+            if (group_space < 0)
+                break;
+            const DecodedProgram &program = *code_spaces[group_space].program;
+            const int program_size = program.instructions.size();
+
+            int group_size = 0;
+            int others_pc = INT_MAX; // Lowest PC of an active lane that may join the group
+            long long group_budget = LLONG_MAX; // Steps before a group lane runs out
+            for (int lane = 0; lane < NUM_CORES; lane++)
+            {
+                bool active = executed[lane] != max_instructions_per_core && core_space[lane] == group_space;
+                mask[lane] = (active && pc[lane] == group_pc) ? -1 : 0;
+                if (mask[lane])
+                {
+                    group_size++;
+                    if (max_instructions_per_core >= 0)
+                        group_budget = min(group_budget, max_instructions_per_core - executed[lane]);
+                }
+                else if (active && pc[lane] >= 0 && pc[lane] / 4 < program_size)
+                    others_pc = min(others_pc, pc[lane]);
+            }
+
+            // Run the group until its lanes diverge, run out of budget,
+            // reach another lane's PC or leave the program
+            long long steps = 0;
+            int lane_pc[NUM_CORES];
+            bool diverged = false;
+            while (true)
+            {
+                const Instruction &inst = program.instructions[group_pc / 4];
+                switch (inst.kind)
+                {
+                case OP_ADD:
+                case OP_SUB:
+                    lanes_add(lanes[inst.rd], lanes[inst.rs1], lanes[inst.rs2], mask, inst.kind == OP_SUB);
+                    break;
+                case OP_SWAP:
+                    lanes_swap(lanes[inst.rs1], lanes[inst.rs2], mask);
+                    break;
+                default:
+                    break;
+                }
+                steps++;
 
-                    // Decode Stage
-                    if (decode_stage[core.core_id].valid)
+                int next_pc = group_pc + 4;
+                if (inst.kind == OP_JAL)
+                {
+                    for (int lane = 0; lane < NUM_CORES; lane++)
                     {
-                        if (forwarding_enabled)
-                        {
-                            perform_data_forwarding(core);
-                        }
-                        cout << "Core " << core.core_id << " - Decode: " << decode_stage[core.core_id].instruction.opcode << endl;
-                        Instruction decoded_instruction = decode(decode_stage[core.core_id].instruction);
-                        PipelineStage &stage = decode_stage[core.core_id];
-                        execute_stage[core.core_id] = stage;
-                        execute_stage[core.core_id].latency_counter = instruction_latencies[decoded_instruction.opcode];
-                        decode_stage[core.core_id].valid = false;
+                        if (mask[lane])
+                            lanes[inst.rd][lane] = group_pc + 4;
                     }
-
-                    // Fetch Stage
-                    if (fetch_stage[core.core_id].valid)
+                    next_pc = group_pc + inst.imm + 4;
+                }
+                else if (inst.kind == OP_BNE)
+                {
+                    int taken = 0;
+                    for (int lane = 0; lane < NUM_CORES; lane++)
                     {
-                        // Check for data hazards before moving to the decode stage
-                        if (check_data_hazards(core))
-                        {
-                            core.stalled = true;
-                            cout << "Core " << core.core_id << " - Stalled at Fetch due to data hazard" << endl;
-                            continue; //
-
-                        }
-                        else
+                        lane_pc[lane] = pc[lane];
+                        if (mask[lane])
                         {
-                            core.stalled = false;
-                            cout << "Core " << core.core_id << " - Fetch: " << fetch_stage[core.core_id].instruction.opcode << endl;
-                            Instruction fetched_instruction = fetch_stage[core.core_id].instruction;
-                            PipelineStage &stage = fetch_stage[core.core_id];
-                            decode_stage[core.core_id] = stage;
-                            fetch_stage[core.core_id].valid = false;
+                            bool lane_taken = lanes[inst.rd][lane] != lanes[inst.rs1][lane];
+                            lane_pc[lane] = lane_taken ? group_pc + inst.imm : group_pc + 4;
+                            taken += lane_taken;
                         }
                     }
+                    diverged = taken != 0 && taken != group_size;
+                    if (taken)
+                        next_pc = group_pc + inst.imm;
+                }
 
-                    // Fetch new instruction if the core is not stalled
-                    if (!core.stalled && core.pc / 4 < instructions.size())
+                if (diverged)
+                {
+                    for (int lane = 0; lane < NUM_CORES; lane++)
                     {
-                        Instruction new_instruction = fetch(core);
-                        fetch_stage[core.core_id].instruction = new_instruction;
-                        fetch_stage[core.core_id].valid = true;
-                        core.pc += 4; // Increment PC after fetching
+                        pc[lane] = lane_pc[lane];
                     }
+                    break;
                 }
+                group_pc = next_pc;
+                if (steps == group_budget || group_pc < 0 || group_pc / 4 >= program_size || group_pc >= others_pc)
+                    break;
+            }
+
+            for (int lane = 0; lane < NUM_CORES; lane++)
+            {
+                if (!mask[lane])
+                    continue;
+                if (!diverged)
+                    pc[lane] = group_pc;
+                executed[lane] += steps;
             }
+            if (group_size > 1)
+                vector_steps += steps;
+            else
+                scalar_steps += steps;
         }
 
-        // Print final statistics
-        cout << "\nSimulation completed in " << total_cycles << " cycles." << endl;
-        cout << "Total stalls: " << total_stalls << endl;
+        long long total = 0;
+        for (int lane = 0; lane < NUM_CORES; lane++)
+        {
+            for (int r = 0; r < 32; r++)
+            {
+                cores[lane].registers[r] = lanes[r][lane];
+            }
+            cores[lane].pc = pc[lane];
+            total += executed[lane];
+        }
+        functional_instructions += total;
+
+        cout << "\nLockstep simulation executed " << total << " instructions (" << vector_steps
+             << " SIMD steps, " << scalar_steps << " scalar steps)." << endl;
+        return total;
     }
 
     // Prints the contents of memory
     void print_memory()
     {
         cout << "Memory Contents:" << endl;
-        for (int i = 0; i < MEMORY_SIZE; i++)
+        for (size_t i = 0; i < memory.size(); i++)
         {
             cout << "Address " << i << ": " << memory[i] << endl;
         }
@@ -533,25 +4376,564 @@ public:
     }
 };
 
-int main()
+// C interface (riscv_sim.h). The opaque handle is the simulator itself.
+struct riscv_sim : RiscVSimulator
+{
+    explicit riscv_sim(int memory_words) : RiscVSimulator(memory_words) {}
+};
+
+extern "C"
+{
+    riscv_sim *riscv_sim_create(int memory_words)
+    {
+        try
+        {
+            riscv_sim *sim = new riscv_sim(memory_words > 0 ? memory_words : MEMORY_SIZE);
+            sim->set_trace(false);
+            sim->set_verbose(false);
+            return sim;
+        }
+        catch (...)
+        {
+            return nullptr;
+        }
+    }
+
+    void riscv_sim_destroy(riscv_sim *sim)
+    {
+        delete sim;
+    }
+
+    int riscv_sim_load_program(riscv_sim *sim, const char *filename)
+    {
+        try
+        {
+            return sim->load_instructions(filename) ? 0 : -1;
+        }
+        catch (...)
+        {
+            return -1;
+        }
+    }
+
+    int riscv_sim_load_core_program(riscv_sim *sim, int core, const char *filename, int entry_pc)
+    {
+        try
+        {
+            return sim->load_core_program(core, filename, entry_pc) ? 0 : -1;
+        }
+        catch (...)
+        {
+            return -1;
+        }
+    }
+
+    void riscv_sim_set_latency(riscv_sim *sim, const char *opcode, int latency)
+    {
+        sim->set_instruction_latency(opcode, latency);
+    }
+
+    void riscv_sim_set_forwarding(riscv_sim *sim, int enable)
+    {
+        sim->enable_forwarding(enable != 0);
+    }
+
+    void riscv_sim_set_trace(riscv_sim *sim, int enable)
+    {
+        sim->set_trace(enable != 0);
+    }
+
+    long long riscv_sim_run_cycles(riscv_sim *sim, long long cycles)
+    {
+        return sim->run_cycles(cycles);
+    }
+
+    int riscv_sim_run_until_pc(riscv_sim *sim, int core, int pc, long long max_cycles)
+    {
+        return sim->run_until_pc(core, pc, max_cycles < 0 ? -1 : max_cycles) ? 1 : 0;
+    }
+
+    long long riscv_sim_run_functional(riscv_sim *sim, long long max_instructions_per_core)
+    {
+        return sim->execute_functional(max_instructions_per_core < 0 ? -1 : max_instructions_per_core);
+    }
+
+    int riscv_sim_finished(riscv_sim *sim)
+    {
+        return sim->finished() ? 1 : 0;
+    }
+
+    void riscv_sim_reset(riscv_sim *sim)
+    {
+        sim->reset();
+    }
+
+    int riscv_sim_register(riscv_sim *sim, int core, int reg)
+    {
+        return sim->register_value(core, reg);
+    }
+
+    int riscv_sim_pc(riscv_sim *sim, int core)
+    {
+        return sim->core_pc(core);
+    }
+
+    int riscv_sim_memory_word(riscv_sim *sim, long long address)
+    {
+        return sim->memory_word(address);
+    }
+
+    void riscv_sim_get_stats(riscv_sim *sim, riscv_sim_stats *stats)
+    {
+        SimulationStats detailed = sim->statistics();
+        stats->cycles = detailed.cycles;
+        stats->instructions = detailed.instructions;
+        stats->functional_instructions = sim->functional_instruction_count();
+        stats->stalls = detailed.stalls;
+        stats->cpi = detailed.cpi;
+    }
+
+    int riscv_sim_save_checkpoint(riscv_sim *sim, const char *filename, int incremental)
+    {
+        try
+        {
+            return sim->save_checkpoint(filename, incremental != 0) ? 0 : -1;
+        }
+        catch (...)
+        {
+            return -1;
+        }
+    }
+
+    int riscv_sim_load_checkpoint(riscv_sim *sim, const char *filename)
+    {
+        try
+        {
+            return sim->load_checkpoint(filename) ? 0 : -1;
+        }
+        catch (...)
+        {
+            return -1;
+        }
+    }
+
+    int riscv_sim_translate(riscv_sim *sim, const char *filename)
+    {
+        try
+        {
+            return sim->translate_to_cpp(filename) ? 0 : -1;
+        }
+        catch (...)
+        {
+            return -1;
+        }
+    }
+}
+
+#ifndef RISCV_SIM_NO_MAIN
+// Run configuration of the command-line simulator. The defaults reproduce
+// the original hardcoded setup.
+struct SimulatorOptions
+{
+    string program;                        // Program loaded for every core
+    vector<pair<int, pair<string, int>>> core_programs; // core -> (file, entry PC)
+    int memory_words;
+    bool huge_pages;
+    map<string, int> latencies;
+    bool forwarding;
+    bool precise_pipeline;
+    bool trace;
+    SimulationMode mode;
+    string output;                         // full, registers or summary
+    string translate;                      // Write the programs as C++ here instead of simulating
+    SweepSpace sweep;                      // Ranges of a design-space sweep run instead of the program
+    bool sweeping;                         // A sweep option was given
+    long long sweep_samples;               // Random points of the sweep to run (0 = all)
+    string sweep_cache;                    // Sweep result cache file
+
+    SimulatorOptions()
+        : program("instructions.txt"), memory_words(MEMORY_SIZE), huge_pages(false),
+          forwarding(true), precise_pipeline(false), trace(true), mode(DETAILED_MODE), output("full"),
+          sweeping(false), sweep_samples(0)
+    {
+        sweep.forwarding.clear();
+        latencies["ADD"] = 2;
+        latencies["SUB"] = 2;
+    }
+};
+
+static void print_usage()
+{
+    cout << "Usage: simulator [options] [program]\n"
+            "  --config FILE            read options from FILE (one 'key = value' per line, # comments)\n"
+            "  --program FILE           program for every core (default instructions.txt)\n"
+            "  --core-program C:FILE[:ENTRY]  separate program for core C\n"
+            "  --cores N                number of cores (must be " << NUM_CORES << " in this build)\n"
+            "  --memory WORDS           simulated memory size (default " << MEMORY_SIZE << ")\n"
+            "  --huge-pages on|off      back memory with huge pages\n"
+            "  --latency OP=CYCLES      execute latency of an opcode (default ADD=2 SUB=2)\n"
+            "  --forwarding on|off      data forwarding (default on)\n"
+            "  --precise-pipeline on|off  resolve branches against their own PC and squash\n"
+            "                           younger fetches (default off: the original pipeline)\n"
+            "  --trace on|off           per-stage pipeline trace (default on)\n"
+            "  --mode MODE              detailed, functional, lockstep, event, parallel, verify\n"
+            "                           or verify-functional\n"
+            "  --output MODE            full (registers, memory, sorted memory), registers or summary\n"
+            "  --translate FILE         write the programs as a standalone C++ program to FILE\n"
+            "                           instead of simulating them\n"
+            "  --sweep-latency OP=C1,C2,...  sweep the latency of an opcode over these values\n"
+            "  --sweep-forwarding on,off     sweep data forwarding over these settings\n"
+            "  --sweep-samples N        simulate N random points of the sweep (default all)\n"
+            "  --sweep-cache FILE       remember sweep results in FILE across runs\n"
+            "                           Any sweep option runs the sweep instead of the program.\n"
+            "Config file keys are the option names without the leading dashes.\n";
+}
+
+static bool parse_switch(const string &value, bool &flag)
+{
+    if (value == "on" || value == "true" || value == "1" || value == "yes")
+        flag = true;
+    else if (value == "off" || value == "false" || value == "0" || value == "no")
+        flag = false;
+    else
+        return false;
+    return true;
+}
+
+static bool parse_number(const string &value, long long &number)
+{
+    char *end = nullptr;
+    number = strtoll(value.c_str(), &end, 0);
+    return !value.empty() && *end == '\0';
+}
+
+// Splits a comma-separated list of values, each accepted by parse
+template <typename T, typename Parse>
+static bool parse_list(const string &value, vector<T> &list, Parse parse)
+{
+    list.clear();
+    stringstream items(value);
+    string item;
+    while (getline(items, item, ','))
+    {
+        T parsed;
+        if (!parse(item, parsed))
+            return false;
+        list.push_back(parsed);
+    }
+    return !list.empty();
+}
+
+static bool read_config_file(const string &filename, SimulatorOptions &options, int depth);
+
+// Applies one option; returns false (after printing why) if it is invalid
+static bool apply_option(SimulatorOptions &options, const string &key, const string &value, int depth = 0)
+{
+    long long number = 0;
+    bool ok = true;
+    if (key == "config")
+    {
+        return read_config_file(value, options, depth + 1);
+    }
+    else if (key == "program")
+    {
+        options.program = value;
+    }
+    else if (key == "core-program")
+    {
+        // CORE:FILE[:ENTRY]
+        size_t first = value.find(':');
+        size_t last = value.rfind(':');
+        long long core = 0, entry = 0;
+        string file = value.substr(first + 1);
+        if (last != first && parse_number(value.substr(last + 1), entry))
+            file = value.substr(first + 1, last - first - 1);
+        ok = first != string::npos && parse_number(value.substr(0, first), core) &&
+             core >= 0 && core < NUM_CORES && !file.empty();
+        if (ok)
+            options.core_programs.push_back(make_pair((int)core, make_pair(file, (int)entry)));
+    }
+    else if (key == "cores")
+    {
+        ok = parse_number(value, number) && number == NUM_CORES;
+        if (!ok)
+        {
+            cerr << "Error: This build simulates " << NUM_CORES << " cores (NUM_CORES)" << endl;
+            return false;
+        }
+    }
+    else if (key == "memory")
+    {
+        ok = parse_number(value, number) && number > 0 && number <= INT_MAX;
+        options.memory_words = number;
+    }
+    else if (key == "huge-pages")
+    {
+        ok = parse_switch(value, options.huge_pages);
+    }
+    else if (key == "latency")
+    {
+        // OP=CYCLES (or "OP CYCLES" in config files)
+        size_t split = value.find_first_of("= ");
+        size_t cycles = split == string::npos ? split : value.find_first_not_of("= ", split);
+        ok = split > 0 && cycles != string::npos && parse_number(value.substr(cycles), number) &&
+             number >= 0 && number <= INT_MAX;
+        if (ok)
+            options.latencies[value.substr(0, split)] = number;
+    }
+    else if (key == "forwarding")
+    {
+        ok = parse_switch(value, options.forwarding);
+    }
+    else if (key == "precise-pipeline")
+    {
+        ok = parse_switch(value, options.precise_pipeline);
+    }
+    else if (key == "trace")
+    {
+        ok = parse_switch(value, options.trace);
+    }
+    else if (key == "mode")
+    {
+        static const map<string, SimulationMode> modes = {
+            {"detailed", DETAILED_MODE}, {"functional", FUNCTIONAL_MODE}, {"lockstep", LOCKSTEP_MODE},
+            {"event", EVENT_MODE}, {"parallel", PARALLEL_MODE}, {"verify", VERIFY_MODE},
+            {"verify-functional", VERIFY_FUNCTIONAL_MODE}};
+        auto it = modes.find(value);
+        ok = it != modes.end();
+        if (ok)
+            options.mode = it->second;
+    }
+    else if (key == "output")
+    {
+        ok = value == "full" || value == "registers" || value == "summary";
+        options.output = value;
+    }
+    else if (key == "translate")
+    {
+        ok = !value.empty();
+        options.translate = value;
+    }
+    else if (key == "sweep-latency")
+    {
+        // OP=C1,C2,... (or "OP C1,C2,..." in config files)
+        size_t split = value.find_first_of("= ");
+        size_t cycles = split == string::npos ? split : value.find_first_not_of("= ", split);
+        vector<int> range;
+        ok = split > 0 && cycles != string::npos &&
+             parse_list(value.substr(cycles), range, [](const string &item, int &latency)
+                        {
+                            long long number = 0;
+                            if (!parse_number(item, number) || number < 0 || number > INT_MAX)
+                                return false;
+                            latency = (int)number;
+                            return true;
+                        });
+        if (ok)
+            options.sweep.latencies[value.substr(0, split)] = range;
+        options.sweeping = true;
+    }
+    else if (key == "sweep-forwarding")
+    {
+        vector<bool> settings;
+        ok = parse_list(value, settings, [](const string &item, bool &setting) { return parse_switch(item, setting); });
+        options.sweep.forwarding = settings;
+        options.sweeping = true;
+    }
+    else if (key == "sweep-samples")
+    {
+        ok = parse_number(value, number) && number >= 0;
+        options.sweep_samples = number;
+        options.sweeping = true;
+    }
+    else if (key == "sweep-cache")
+    {
+        ok = !value.empty();
+        options.sweep_cache = value;
+        options.sweeping = true;
+    }
+    else if (key == "cache" || key.compare(0, 6, "cache-") == 0)
+    {
+        cerr << "Error: The simulator has no cache model; option '" << key << "' is not supported" << endl;
+        return false;
+    }
+    else
+    {
+        cerr << "Error: Unknown option '" << key << "'" << endl;
+        return false;
+    }
+
+    if (!ok)
+        cerr << "Error: Invalid value '" << value << "' for option '" << key << "'" << endl;
+    return ok;
+}
+
+// Reads "key = value" lines; blank lines and text after '#' are ignored
+static bool read_config_file(const string &filename, SimulatorOptions &options, int depth)
+{
+    if (depth > 8)
+    {
+        cerr << "Error: Config files nested too deeply at " << filename << endl;
+        return false;
+    }
+    ifstream file(filename);
+    if (!file.is_open())
+    {
+        cerr << "Error: Cannot open " << filename << endl;
+        return false;
+    }
+
+    string line;
+    int line_number = 0;
+    while (getline(file, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == string::npos)
+            continue;
+        size_t equals = line.find('=');
+        if (equals == string::npos)
+        {
+            cerr << "Error: " << filename << ":" << line_number << ": expected 'key = value'" << endl;
+            return false;
+        }
+        auto trim = [](const string &text)
+        {
+            size_t first = text.find_first_not_of(" \t\r");
+            size_t last = text.find_last_not_of(" \t\r");
+            return first == string::npos ? string() : text.substr(first, last - first + 1);
+        };
+        string key = trim(line.substr(0, equals));
+        replace(key.begin(), key.end(), '_', '-');
+        if (!apply_option(options, key, trim(line.substr(equals + 1)), depth))
+        {
+            cerr << "  in " << filename << ":" << line_number << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Parses the command line; returns false if the program should not run
+static bool parse_command_line(int argc, char **argv, SimulatorOptions &options, int &status)
+{
+    status = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "-h" || arg == "--help")
+        {
+            print_usage();
+            return false;
+        }
+        if (arg.compare(0, 2, "--") != 0)
+        {
+            options.program = arg;
+            continue;
+        }
+
+        string key = arg.substr(2);
+        string value;
+        size_t equals = key.find('=');
+        if (equals != string::npos && key.compare(0, 7, "latency") != 0)
+        {
+            value = key.substr(equals + 1);
+            key = key.substr(0, equals);
+        }
+        else if (key.compare(0, 8, "latency=") == 0)
+        {
+            value = key.substr(8);
+            key = "latency";
+        }
+        else if (i + 1 < argc)
+        {
+            value = argv[++i];
+        }
+        else
+        {
+            cerr << "Error: Option '" << arg << "' needs a value" << endl;
+            status = 1;
+            return false;
+        }
+
+        if (!apply_option(options, key, value))
+        {
+            status = 1;
+            return false;
+        }
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
 {
-    RiscVSimulator simulator;
+    SimulatorOptions options;
+    int status = 0;
+    if (!parse_command_line(argc, argv, options, status))
+        return status;
+
+    // A sweep runs the program over the swept configurations on the batch
+    // pool; options that aren't swept apply to every point
+    if (options.sweeping)
+    {
+        if (!options.core_programs.empty())
+        {
+            cerr << "Error: A sweep runs one program on every core; --core-program is not supported" << endl;
+            return 1;
+        }
+        options.sweep.program_file = options.program;
+        for (auto &latency : options.latencies)
+        {
+            if (!options.sweep.latencies.count(latency.first))
+                options.sweep.latencies[latency.first] = vector<int>(1, latency.second);
+        }
+        if (options.sweep.forwarding.empty())
+            options.sweep.forwarding.push_back(options.forwarding);
+        vector<SweepResult> results =
+            RiscVSimulator::run_sweep(options.sweep, options.sweep_samples, 1, options.sweep_cache);
+        if (results.empty())
+            return 1;
+        RiscVSimulator::print_sweep(results);
+        return 0;
+    }
+
+    RiscVSimulator simulator(options.memory_words, options.huge_pages);
+    simulator.set_trace(options.trace);
 
     // Load instructions from a file
-    simulator.load_instructions("instructions.txt");
+    if (!simulator.load_instructions(options.program))
+        return 1;
+    for (auto &core_program : options.core_programs)
+    {
+        if (!simulator.load_core_program(core_program.first, core_program.second.first, core_program.second.second))
+            return 1;
+    }
+    if (!options.translate.empty())
+        return simulator.translate_to_cpp(options.translate) ? 0 : 1;
+    // Only worth reporting when huge pages were asked for, so the default
+    // output stays as it was
+    if (options.huge_pages)
+        simulator.print_memory_backing();
 
     // Enable or disable data forwarding
-    simulator.enable_forwarding(true);
+    simulator.enable_forwarding(options.forwarding);
+    simulator.enable_precise_pipeline(options.precise_pipeline);
 
-    // Set custom instruction latencies (optional)
-    simulator.set_instruction_latency("ADD", 2);
-    simulator.set_instruction_latency("SUB", 2);
+    // Set custom instruction latencies
+    for (auto &latency : options.latencies)
+        simulator.set_instruction_latency(latency.first, latency.second);
 
     // Execute the instructions
-    simulator.execute();
+    simulator.set_simulation_mode(options.mode);
+    simulator.run();
 
     // Print final register and memory states
+    if (options.output == "summary")
+        return 0;
     simulator.print_registers();
+    if (options.output == "registers")
+        return 0;
     simulator.print_memory();
 
     // Sort memory partitions
@@ -559,4 +4941,5 @@ int main()
     simulator.print_memory();
 
     return 0;
-}
\ No newline at end of file
+}
+#endif